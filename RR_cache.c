@@ -1,15 +1,23 @@
-캐시
-
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <linux/filter.h>
 
 #define LISTENPORT 5294
 #define PORTNUM1 5297
@@ -19,28 +27,122 @@
 #define NUM_SERVERS 3
 #define QUEUE_SIZE 10
 #define CACHE_SIZE 5 
+#define MAX_ENTRY_SIZE 1024 // 캐시 항목 최대 크기 (백엔드 첫 응답 버퍼), 피어가 보내는 값도 이 이하만 받음
+#define NUM_WORKERS 4 // 샤드당 워커 수
+#define REQUEST_SIZE 1024
+#define INLINE_HITS 1 // 샤드 accept 스레드가 이미 도착한 요청을 읽어 로컬 캐시 히트는 직접 응답, 나머지만 워커로
+
+// 코어별 샤드: 코어마다 리스닝 소켓(SO_REUSEPORT), accept 스레드, 워커, 큐, 캐시를 따로 둠
+#define CPU_AFFINITY 1 // 0이면 샤드 하나, 고정 없음 (기존 동작)
+#define MAX_SHARDS 64
+#define CACHE_LINE 64
+
+// 과부하 제어
+#define TARGET_DELAY_MS 5 // 과부하 상태에서 허용하는 큐 대기 시간
+#define INTERVAL_MS 100 // 큐가 이 시간 동안 한 번도 비지 않으면 과부하로 판단
+#define LATENCY_TARGET_MS 200 // 백엔드 응답이 이보다 느리면 동시 처리 한도 감소
+#define MIN_LIMIT 1.0
+#define MAX_LIMIT 64.0
+
+// 타임아웃 (ms)
+#define CONNECT_TIMEOUT_MS 1000
+#define FIRST_BYTE_TIMEOUT_MS 5000 // 요청 전송 후 첫 응답까지
+#define IDLE_TIMEOUT_MS 10000 // 클라이언트 읽기/쓰기 한 번
+#define TOTAL_TIMEOUT_MS 30000 // 요청 전체
+#define TIMER_TICK_MS 10
+#define TIMER_SLOTS 512 // 한 바퀴 5.12초, 더 긴 타이머는 rounds로 처리
+
+// 헬스 체크: 연속 실패(타임아웃 포함)가 쌓이면 잠시 제외
+#define HEALTH_FAIL_THRESHOLD 3
+#define HEALTH_RETRY_MS 5000
+
+// 피어 캐시: 여러 프록시 인스턴스가 캐시 키의 일관 해시 링을 나눠 갖고
+// 로컬 캐시 미스는 백엔드로 가기 전에 키를 맡은 피어에게 먼저 물어봄
+// 피어 포트는 peers[]의 자기 IP에만 바인드하고, 연결마다 PEER_SECRET을 먼저 확인한 뒤에만 GET/PUT을 받음
+#define PEER_CACHE 0 // 켜기 전에 PEER_SECRET을 인스턴스끼리만 아는 값으로 바꿀 것
+#define PEER_SECRET "change-me-before-enabling"
+#define NUM_PEERS 3
+#define PEER_PORT 6294
+#define PEER_VNODES 100
+#define PEER_CACHE_SIZE 64 // 이 인스턴스가 맡은 키를 보관하는 캐시
+#define PEER_POOL_SIZE 4 // 피어마다 유지하는 연결 수
+#define PEER_TIMEOUT_MS 20 // 피어 조회 전체 제한, 넘으면 백엔드로
+#define PEER_RETRY_MS 1000 // 실패한 피어는 이 시간 동안 묻지 않음
+#define PEER_GET 1
+#define PEER_PUT 2
+#define PEER_HELLO 3 // 연결 직후 한 번, key에 PEER_SECRET
+#define PEER_HIT 1
+#define PEER_MISS 0
+
+// 타임아웃 종류
+#define TIMEOUT_CONNECT 0
+#define TIMEOUT_FIRST_BYTE 1
+#define TIMEOUT_IDLE 2
+#define TIMEOUT_TOTAL 3
+
+// 락 통계: -DLOCK_STATS로 빌드하면 LOCK/UNLOCK/COND_WAIT가 등록한 뮤텍스마다 대기/보유 시간 기록, SIGUSR2로 출력
+// 샤드마다 있는 큐/캐시 락은 이름이 같아 합쳐서 출력
+#include "lock_stats.h"
 
 typedef struct {
     char ip[16];
     int port;
 } server_info;
 
+// 캐시 응답 버퍼 (생성 후 수정하지 않음, 참조 카운트로 해제)
+typedef struct {
+    int refcount;
+    int len;
+    char data[];
+} ResponseBuf;
+
 typedef struct {
     int client_socket;
+    long enqueued_ms; // 큐 대기 시간 측정용
+    int request_len; // accept 스레드가 이미 읽은 요청 길이, 0이면 워커가 recv
+    ResponseBuf* pending; // accept 스레드가 다 보내지 못한 캐시 응답 (참조 하나를 넘겨받음), 워커가 나머지만 보냄
+    int pending_sent;
+    char request[REQUEST_SIZE];
 } client_request;
 
 typedef struct {
     client_request requests[QUEUE_SIZE];
     int front, rear, count;
+    long last_empty_ms; // 큐가 마지막으로 비어 있던 시각 (비었다가 요청이 들어올 때도 갱신)
     pthread_mutex_t mutex;
     pthread_cond_t cond_non_empty;
-    pthread_cond_t cond_non_full;
 } request_queue;
 
+// 백엔드별 동시 처리 한도 (AIMD)와 헬스 상태
+typedef struct {
+    int inflight;
+    double limit;
+    int failures; // 연속 실패 횟수
+    long down_until_ms; // 이 시각까지 선택하지 않음, 0이 아니고 지났으면 확인 요청 하나만 보냄 (half-open)
+    int probing; // 확인 요청이 진행 중
+} backend_limit;
+
+// 타이머 휠 항목, 만료되면 fds를 shutdown 해서 막혀 있는 connect/recv/send를 깨움
+typedef struct timer {
+    struct timer* prev;
+    struct timer* next;
+    int slot; // -1이면 등록 안 됨
+    int rounds;
+    int fds[2];
+    int kind;
+    int expired;
+} timer;
+
+typedef struct {
+    timer* slots[TIMER_SLOTS];
+    int current;
+    pthread_mutex_t mutex;
+} timer_wheel;
+
 // LRU 캐시시
 typedef struct CacheNode {
     char key[1024];              
-    char value[1024];            
+    ResponseBuf* value;          
     struct CacheNode* prev;      
     struct CacheNode* next;     
 } CacheNode;
@@ -49,205 +151,887 @@ typedef struct {
     CacheNode* head;             
     CacheNode* tail;             
     int size;                    // 현재 사이즈
+    int capacity;
     pthread_mutex_t mutex;       // 캐시 동기화
 } LRUCache;
 
+// 피어 프로토콜 헤더 (네트워크 바이트 순서), 뒤에 key, value가 이어짐
+// GET 응답은 status와 value_len만 씀, PUT은 응답 없음
+typedef struct {
+    uint8_t op;
+    uint8_t status;
+    uint16_t key_len;
+    uint32_t value_len;
+} peer_header;
+
+// 피어별 연결 풀과 상태
+typedef struct {
+    int fds[PEER_POOL_SIZE];
+    int count;
+    long down_until_ms;
+    pthread_mutex_t mutex;
+} peer_pool;
+
+typedef struct {
+    unsigned int hash;
+    int peer;
+} peer_point;
+
+// 코어 하나의 상태, 그 코어에 고정된 스레드가 할당해서 로컬 NUMA 노드 메모리에 놓임
+typedef struct {
+    request_queue queue __attribute__((aligned(CACHE_LINE)));
+    LRUCache cache __attribute__((aligned(CACHE_LINE)));
+    queue_stats queue_usage __attribute__((aligned(CACHE_LINE))); // queue.mutex로 보호
+    int current_server_index __attribute__((aligned(CACHE_LINE)));
+    int index;
+    int cpu;
+    int listen_socket;
+} shard;
+
 server_info web_servers[] = {
     {"10.198.138.212", PORTNUM1},
     {"10.198.138.212", PORTNUM2},
     {"10.198.138.212", PORTNUM3}
 };
 
-request_queue queue = {
-    .front = 0,
-    .rear = 0,
-    .count = 0,
-    .mutex = PTHREAD_MUTEX_INITIALIZER,
-    .cond_non_empty = PTHREAD_COND_INITIALIZER,
-    .cond_non_full = PTHREAD_COND_INITIALIZER
+// 같은 호스트에서 여러 인스턴스를 띄울 때는 포트를 달리 함, 다른 호스트면 IP 수정
+server_info peers[NUM_PEERS] = {
+    {"127.0.0.1", PEER_PORT},
+    {"127.0.0.1", PEER_PORT + 1},
+    {"127.0.0.1", PEER_PORT + 2}
 };
-
-int current_server_index = 0;
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-
-LRUCache cache = {
+int self_index = 0; // 실행 인자로 지정, 클라이언트 포트도 LISTENPORT + self_index
+peer_pool peer_pools[NUM_PEERS];
+peer_point peer_ring[NUM_PEERS * PEER_VNODES];
+LRUCache peer_cache = {
     .head = NULL,
     .tail = NULL,
     .size = 0,
+    .capacity = PEER_CACHE_SIZE,
+    .mutex = PTHREAD_MUTEX_INITIALIZER
+};
+
+int num_shards = 1;
+int shard_cpus[MAX_SHARDS];
+int listen_sockets[MAX_SHARDS];
+shard* shards[MAX_SHARDS]; // 통계 출력용, 샤드 스레드가 초기화를 마치면 채움
+__thread shard* local_shard; // 현재 스레드가 속한 샤드
+
+backend_limit limits[NUM_SERVERS] = {
+    {0, NUM_WORKERS, 0, 0, 0},
+    {0, NUM_WORKERS, 0, 0, 0},
+    {0, NUM_WORKERS, 0, 0, 0}
+};
+pthread_mutex_t limit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+timer_wheel wheel = {
+    .current = 0,
     .mutex = PTHREAD_MUTEX_INITIALIZER
 };
+long timeout_counts[4]; // 종류별 타임아웃 횟수
+const char* timeout_names[4] = { "connect", "first byte", "idle", "total" };
+
+const char overload_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
 
-//RR
+//RR (샤드마다 카운터를 따로 둬서 코어 사이 캐시 라인 이동 없음)
 int load_balance() {
-    pthread_mutex_lock(&lock);
-    int server_index = current_server_index;
-    current_server_index = (current_server_index + 1) % NUM_SERVERS;
-    pthread_mutex_unlock(&lock);
-    return server_index;
+    unsigned int n = __atomic_fetch_add(&local_shard->current_server_index, 1, __ATOMIC_RELAXED);
+    return n % NUM_SERVERS;
 }
 
 
-void enqueue(int client_socket) {
-    pthread_mutex_lock(&queue.mutex);
-    while (queue.count == QUEUE_SIZE) {
-        pthread_cond_wait(&queue.cond_non_full, &queue.mutex);
-    }
-    queue.requests[queue.rear].client_socket = client_socket;
-    queue.rear = (queue.rear + 1) % QUEUE_SIZE;
-    queue.count++;
-    pthread_cond_signal(&queue.cond_non_empty);
-    pthread_mutex_unlock(&queue.mutex);
+long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+// 과부하로 받지 않는 요청은 바로 503 후 종료
+void reject_overload(int client_socket) {
+    send(client_socket, overload_response, sizeof(overload_response) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(client_socket);
+}
 
-int dequeue() {
-    pthread_mutex_lock(&queue.mutex);
-    while (queue.count == 0) {
-        pthread_cond_wait(&queue.cond_non_empty, &queue.mutex);
+// 큐가 가득 차면 accept 스레드를 막지 않고 -1 반환
+// request_len이 0보다 크면 accept 스레드가 읽은 요청을 함께 넘김
+int enqueue(int client_socket, const char* request, int request_len, ResponseBuf* pending, int pending_sent) {
+    request_queue* queue = &local_shard->queue;
+    LOCK(&queue->mutex);
+    if (queue->count == QUEUE_SIZE) {
+        local_shard->queue_usage.full_rejects++;
+        UNLOCK(&queue->mutex);
+        return -1;
+    }
+    long now = now_ms();
+    // 빈 큐에 처음 들어오는 요청: 방금까지 비어 있었으므로 과부하 판단 구간을 여기서 새로 시작
+    if (queue->count == 0) {
+        queue->last_empty_ms = now;
+    }
+    queue->requests[queue->rear].client_socket = client_socket;
+    queue->requests[queue->rear].enqueued_ms = now;
+    queue->requests[queue->rear].request_len = request_len;
+    queue->requests[queue->rear].pending = pending;
+    queue->requests[queue->rear].pending_sent = pending_sent;
+    memcpy(queue->requests[queue->rear].request, request, request_len);
+    queue_usage_update(&local_shard->queue_usage, queue->count);
+    queue->rear = (queue->rear + 1) % QUEUE_SIZE;
+    queue->count++;
+    pthread_cond_signal(&queue->cond_non_empty);
+    UNLOCK(&queue->mutex);
+    return 0;
+}
+
+// CoDel 방식 큐 관리
+// 큐가 INTERVAL_MS 넘게 계속 차 있으면 TARGET_DELAY_MS 넘게 기다린 요청은 *shed = 1
+// 미리 읽은 요청은 req에 복사
+int dequeue(int* shed, client_request* req) {
+    request_queue* queue = &local_shard->queue;
+    LOCK(&queue->mutex);
+    while (queue->count == 0) {
+        COND_WAIT(&queue->cond_non_empty, &queue->mutex);
+    }
+    client_request* front = &queue->requests[queue->front];
+    int client_socket = front->client_socket;
+    req->request_len = front->request_len;
+    req->pending = front->pending;
+    req->pending_sent = front->pending_sent;
+    memcpy(req->request, front->request, front->request_len);
+    long now = now_ms();
+    long sojourn = now - front->enqueued_ms;
+    long max_delay = now - queue->last_empty_ms > INTERVAL_MS ? TARGET_DELAY_MS : INTERVAL_MS;
+    *shed = sojourn > max_delay;
+    queue_usage_update(&local_shard->queue_usage, queue->count);
+    queue->front = (queue->front + 1) % QUEUE_SIZE;
+    queue->count--;
+    if (queue->count == 0) {
+        queue->last_empty_ms = now;
     }
-    int client_socket = queue.requests[queue.front].client_socket;
-    queue.front = (queue.front + 1) % QUEUE_SIZE;
-    queue.count--;
-    pthread_cond_signal(&queue.cond_non_full);
-    pthread_mutex_unlock(&queue.mutex);
+    UNLOCK(&queue->mutex);
     return client_socket;
 }
 
-// 캐시 검색
-CacheNode* cache_search(const char* key) {
-    pthread_mutex_lock(&cache.mutex);
-    CacheNode* node = cache.head;
+// 라운드 로빈 순서대로 동시 처리 한도가 남은 백엔드 선택, 모두 가득 차면 -1
+// 제외 시간이 끝난 백엔드는 확인 요청 하나에만 선택되고 그때 *probe = 1
+int backend_acquire(int* probe) {
+    int first = load_balance();
+    long now = now_ms();
+    LOCK(&limit_lock);
+    for (int i = 0; i < NUM_SERVERS; i++) {
+        int server_index = (first + i) % NUM_SERVERS;
+        backend_limit* l = &limits[server_index];
+        if (l->inflight >= (int)l->limit || now < l->down_until_ms) {
+            continue;
+        }
+        *probe = l->down_until_ms != 0;
+        if (*probe && l->probing) {
+            continue;
+        }
+        l->probing |= *probe;
+        l->inflight++;
+        UNLOCK(&limit_lock);
+        return server_index;
+    }
+    UNLOCK(&limit_lock);
+    return -1;
+}
+
+// 응답 시간으로 한도 조정 (AIMD)
+// probe면 확인 요청 결과로 복구하거나 다시 제외
+void backend_release(int server_index, long latency_ms, int ok, int probe) {
+    LOCK(&limit_lock);
+    backend_limit* l = &limits[server_index];
+    l->inflight--;
+    if (probe) {
+        l->probing = 0;
+        l->down_until_ms = ok ? 0 : now_ms() + HEALTH_RETRY_MS;
+        if (ok) fprintf(stderr, "server %d back up\n", server_index);
+    }
+    if (ok && latency_ms <= LATENCY_TARGET_MS) {
+        l->limit += 1.0 / l->limit;
+        if (l->limit > MAX_LIMIT) l->limit = MAX_LIMIT;
+    }
+    else {
+        l->limit *= 0.9;
+        if (l->limit < MIN_LIMIT) l->limit = MIN_LIMIT;
+    }
+    if (ok) {
+        l->failures = 0;
+    }
+    else if (!probe && l->down_until_ms == 0 && ++l->failures >= HEALTH_FAIL_THRESHOLD) {
+        // 재시도 시간이 지나면 요청 하나로 다시 확인 (probing으로 하나만 보냄)
+        l->down_until_ms = now_ms() + HEALTH_RETRY_MS;
+        l->failures = 0;
+        fprintf(stderr, "server %d marked down for %d ms\n", server_index, HEALTH_RETRY_MS);
+    }
+    UNLOCK(&limit_lock);
+}
+
+// 타이머 등록 (O(1)), fd2는 없으면 -1
+void timer_arm(timer* t, int timeout_ms, int fd1, int fd2, int kind) {
+    int ticks = (timeout_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (ticks < 1) ticks = 1;
+    LOCK(&wheel.mutex);
+    t->slot = (wheel.current + ticks) % TIMER_SLOTS;
+    t->rounds = (ticks - 1) / TIMER_SLOTS;
+    t->fds[0] = fd1;
+    t->fds[1] = fd2;
+    t->kind = kind;
+    t->expired = 0;
+    t->prev = NULL;
+    t->next = wheel.slots[t->slot];
+    if (t->next) t->next->prev = t;
+    wheel.slots[t->slot] = t;
+    UNLOCK(&wheel.mutex);
+}
+
+// 타이머 해제 (O(1)), 이후에는 만료 처리가 fd를 건드리지 않으므로 소켓을 닫아도 됨
+void timer_cancel(timer* t) {
+    LOCK(&wheel.mutex);
+    if (t->slot >= 0) {
+        if (t->prev) t->prev->next = t->next;
+        else wheel.slots[t->slot] = t->next;
+        if (t->next) t->next->prev = t->prev;
+        t->slot = -1;
+    }
+    UNLOCK(&wheel.mutex);
+}
+
+// 등록된 타이머의 두 번째 fd 교체 (서버 소켓을 열고 닫을 때)
+void timer_attach(timer* t, int fd) {
+    LOCK(&wheel.mutex);
+    t->fds[1] = fd;
+    UNLOCK(&wheel.mutex);
+}
+
+int timer_expired(timer* t) {
+    return __atomic_load_n(&t->expired, __ATOMIC_ACQUIRE);
+}
+
+// 타이머 스레드: 틱마다 슬롯 하나만 확인
+void* timer_thread(void* arg) {
+    while (1) {
+        struct timespec tick = { 0, TIMER_TICK_MS * 1000000L };
+        nanosleep(&tick, NULL);
+
+        LOCK(&wheel.mutex);
+        wheel.current = (wheel.current + 1) % TIMER_SLOTS;
+        timer* t = wheel.slots[wheel.current];
+        while (t) {
+            timer* next = t->next;
+            if (t->rounds > 0) {
+                t->rounds--;
+            }
+            else {
+                if (t->prev) t->prev->next = t->next;
+                else wheel.slots[t->slot] = t->next;
+                if (t->next) t->next->prev = t->prev;
+                t->slot = -1;
+                __atomic_store_n(&t->expired, 1, __ATOMIC_RELEASE);
+                for (int i = 0; i < 2; i++) {
+                    if (t->fds[i] >= 0) shutdown(t->fds[i], SHUT_RDWR);
+                }
+            }
+            t = next;
+        }
+        UNLOCK(&wheel.mutex);
+    }
+    return NULL;
+}
+
+// 실패한 작업이 타임아웃 때문인지 확인하고 집계
+int check_timeout(timer* total, timer* phase) {
+    int kind = -1;
+    if (timer_expired(total)) kind = TIMEOUT_TOTAL;
+    else if (timer_expired(phase)) kind = phase->kind;
+    if (kind >= 0) {
+        long count = __atomic_add_fetch(&timeout_counts[kind], 1, __ATOMIC_RELAXED);
+        fprintf(stderr, "%s timeout (%ld so far)\n", timeout_names[kind], count);
+    }
+    return kind >= 0;
+}
+
+ResponseBuf* buf_create(const char* data, int len) {
+    ResponseBuf* buf = malloc(sizeof(ResponseBuf) + len);
+    if (!buf) {
+        return NULL;
+    }
+    buf->refcount = 1;
+    buf->len = len;
+    memcpy(buf->data, data, len);
+    return buf;
+}
+
+void buf_retain(ResponseBuf* buf) {
+    __atomic_add_fetch(&buf->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void buf_release(ResponseBuf* buf) {
+    if (__atomic_sub_fetch(&buf->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(buf);
+    }
+}
+
+// 캐시 검색, 히트 시 응답 버퍼의 참조를 반환 (사용 후 buf_release)
+ResponseBuf* cache_search(LRUCache* cache, const char* key) {
+    LOCK(&cache->mutex);
+    CacheNode* node = cache->head;
     while (node) {
         if (strcmp(node->key, key) == 0) {
             // 캐시 히트 시 ->  노드를 맨 앞으로 이동
-            if (node != cache.head) {
+            if (node != cache->head) {
                 // 노드 제거
                 if (node->prev) node->prev->next = node->next;
                 if (node->next) node->next->prev = node->prev;
-                if (node == cache.tail) cache.tail = node->prev;
+                if (node == cache->tail) cache->tail = node->prev;
 
                 // 노드를 맨 앞으로 이동
-                node->next = cache.head;
+                node->next = cache->head;
                 node->prev = NULL;
-                if (cache.head) cache.head->prev = node;
-                cache.head = node;
+                if (cache->head) cache->head->prev = node;
+                cache->head = node;
             }
-            pthread_mutex_unlock(&cache.mutex);
-            return node;
+            ResponseBuf* buf = node->value;
+            buf_retain(buf);
+            UNLOCK(&cache->mutex);
+            return buf;
         }
         node = node->next;
     }
-    pthread_mutex_unlock(&cache.mutex);
+    UNLOCK(&cache->mutex);
     return NULL;
 }
 
 
-void cache_add(const char* key, const char* value) {
-    pthread_mutex_lock(&cache.mutex);
-    if (cache.size >= CACHE_SIZE) {
+void cache_add(LRUCache* cache, const char* key, const char* value, int len) {
+    // 노드와 버퍼는 락 밖에서 준비
+    CacheNode* new_node = (CacheNode*)malloc(sizeof(CacheNode));
+    if (!new_node) {
+        return;
+    }
+    new_node->value = buf_create(value, len);
+    if (!new_node->value) {
+        free(new_node);
+        return;
+    }
+    strncpy(new_node->key, key, sizeof(new_node->key) - 1);
+    new_node->key[sizeof(new_node->key) - 1] = '\0';
+
+    CacheNode* evicted = NULL;
+    LOCK(&cache->mutex);
+    if (cache->size >= cache->capacity) {
         // 가장 오래된 노드 제거
-        CacheNode* old_tail = cache.tail;
-        if (old_tail->prev) old_tail->prev->next = NULL;
-        cache.tail = old_tail->prev;
-        free(old_tail);
-        cache.size--;
+        evicted = cache->tail;
+        if (evicted->prev) evicted->prev->next = NULL;
+        cache->tail = evicted->prev;
+        if (cache->head == evicted) cache->head = NULL;
+        cache->size--;
     }
 
     // 노드 추가
-    CacheNode* new_node = (CacheNode*)malloc(sizeof(CacheNode));
-    strcpy(new_node->key, key);
-    strcpy(new_node->value, value);
-    new_node->next = cache.head;
+    new_node->next = cache->head;
     new_node->prev = NULL;
-    if (cache.head) cache.head->prev = new_node;
-    cache.head = new_node;
-    if (!cache.tail) cache.tail = new_node;
-    cache.size++;
-    pthread_mutex_unlock(&cache.mutex);
+    if (cache->head) cache->head->prev = new_node;
+    cache->head = new_node;
+    if (!cache->tail) cache->tail = new_node;
+    cache->size++;
+    UNLOCK(&cache->mutex);
+
+    // 전송 중인 스레드가 있으면 버퍼는 마지막 참조가 해제
+    if (evicted) {
+        buf_release(evicted->value);
+        free(evicted);
+    }
 }
 
-void* handle_client(void* arg) {
-    while (1) {
-        int client_socket = dequeue();
+int send_all(int sock, const char* data, int len) {
+    int sent = 0;
+    while (sent < len) {
+        int n = send(sock, data + sent, len - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return -1;
+        }
+        sent += n;
+    }
+    return sent;
+}
 
-        char buffer[1024];
-        int bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-        if (bytes_received <= 0) {
-            perror("recv from client failed");
-            close(client_socket);
-            continue;
+unsigned int fnv_hash(const char* key) {
+    unsigned int h = 2166136261u;
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int compare_peer_point(const void* a, const void* b) {
+    unsigned int x = ((const peer_point*)a)->hash;
+    unsigned int y = ((const peer_point*)b)->hash;
+    return (x > y) - (x < y);
+}
+
+void build_peer_ring() {
+    for (int i = 0; i < NUM_PEERS; i++) {
+        for (int v = 0; v < PEER_VNODES; v++) {
+            char name[sizeof(peers[i].ip) + 24]; // ip:port#vnode (포트와 vnode는 int 최대 자릿수까지)
+            snprintf(name, sizeof(name), "%.15s:%d#%d", peers[i].ip, peers[i].port, v);
+            peer_ring[i * PEER_VNODES + v].hash = fnv_hash(name);
+            peer_ring[i * PEER_VNODES + v].peer = i;
         }
-        buffer[bytes_received] = '\0';
+        pthread_mutex_init(&peer_pools[i].mutex, NULL);
+        register_lock(&peer_pools[i].mutex, "peer_pools[].mutex");
+    }
+    qsort(peer_ring, NUM_PEERS * PEER_VNODES, sizeof(peer_point), compare_peer_point);
+}
 
-        // 캐시 확인
-        CacheNode* cached_response = cache_search(buffer);
-        if (cached_response) {
-            // 캐시 응답 반환
-            send(client_socket, cached_response->value, strlen(cached_response->value), 0);
-            close(client_socket);
-            continue;
+// 키를 맡은 피어 번호
+int peer_owner(const char* key) {
+    unsigned int hash = fnv_hash(key);
+    int lo = 0, hi = NUM_PEERS * PEER_VNODES;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (peer_ring[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+    return peer_ring[lo % (NUM_PEERS * PEER_VNODES)].peer;
+}
+
+// deadline까지 len 바이트를 모두 받음, 실패하면 -1
+int peer_recv_all(int fd, char* buf, int len, long deadline_ms) {
+    int got = 0;
+    while (got < len) {
+        int wait = deadline_ms - now_ms();
+        if (wait <= 0) return -1;
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, wait) <= 0) return -1;
+        int n = recv(fd, buf + got, len - got, MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (n <= 0) return -1;
+        got += n;
+    }
+    return got;
+}
+
+int peer_send(int fd, int op, const char* key, const char* value, int value_len) {
+    peer_header header = { op, 0, htons(strlen(key)), htonl(value_len) };
+    struct iovec iov[3] = {
+        { &header, sizeof(header) },
+        { (void*)key, strlen(key) },
+        { (void*)value, value_len }
+    };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = value_len > 0 ? 3 : 2 };
+    int total = sizeof(header) + strlen(key) + value_len;
+    // 작은 메시지라 소켓 버퍼에 한 번에 들어가지 않으면 실패로 봄
+    return sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) == total ? 0 : -1;
+}
+
+// 풀에서 연결을 꺼내거나 새로 연결 (connect도 deadline 안에서), 실패하면 -1
+int peer_checkout(int peer, long deadline_ms) {
+    peer_pool* pool = &peer_pools[peer];
+    LOCK(&pool->mutex);
+    if (now_ms() < pool->down_until_ms) {
+        UNLOCK(&pool->mutex);
+        return -1;
+    }
+    if (pool->count > 0) {
+        int fd = pool->fds[--pool->count];
+        UNLOCK(&pool->mutex);
+        return fd;
+    }
+    UNLOCK(&pool->mutex);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(peers[peer].port);
+    inet_pton(AF_INET, peers[peer].ip, &addr.sin_addr);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        int err = errno;
+        int wait = deadline_ms - now_ms();
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        socklen_t err_len = sizeof(err);
+        if (err != EINPROGRESS || wait <= 0 || poll(&pfd, 1, wait) <= 0 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0) {
+            close(fd);
+            return -1;
         }
+    }
+    // 새 연결은 공유 비밀로 인증 (응답 없음, 틀리면 상대가 연결을 닫음)
+    if (peer_send(fd, PEER_HELLO, PEER_SECRET, NULL, 0) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-        // 로드밸런싱
-        int server_index = load_balance();
-        server_info selected_server = web_servers[server_index];
-        int server_socket;
-        struct sockaddr_in server_addr;
-        server_socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (server_socket < 0) {
-            perror("Socket creation failed for server");
-            close(client_socket);
-            continue;
+// 정상적으로 쓴 연결은 풀로 반환, 실패한 연결은 닫고 피어를 잠시 제외
+void peer_checkin(int peer, int fd, int ok) {
+    peer_pool* pool = &peer_pools[peer];
+    LOCK(&pool->mutex);
+    if (ok && pool->count < PEER_POOL_SIZE) {
+        pool->fds[pool->count++] = fd;
+        fd = -1;
+    }
+    else if (!ok) {
+        pool->down_until_ms = now_ms() + PEER_RETRY_MS;
+    }
+    UNLOCK(&pool->mutex);
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// 키를 맡은 피어의 캐시 조회 (자기 자신이면 피어 캐시에서), 히트 시 버퍼 참조 반환
+ResponseBuf* peer_lookup(const char* key) {
+    if (!PEER_CACHE || strlen(key) > 0xffff) {
+        return NULL;
+    }
+    int owner = peer_owner(key);
+    if (owner == self_index) {
+        return cache_search(&peer_cache, key);
+    }
+
+    long deadline = now_ms() + PEER_TIMEOUT_MS;
+    int fd = peer_checkout(owner, deadline);
+    if (fd < 0) {
+        return NULL;
+    }
+    peer_header header;
+    if (peer_send(fd, PEER_GET, key, NULL, 0) < 0 ||
+        peer_recv_all(fd, (char*)&header, sizeof(header), deadline) < 0) {
+        peer_checkin(owner, fd, 0);
+        return NULL;
+    }
+    ResponseBuf* buf = NULL;
+    if (header.status == PEER_HIT) {
+        int len = ntohl(header.value_len);
+        if (len < 0 || len > MAX_ENTRY_SIZE) {
+            peer_checkin(owner, fd, 0);
+            return NULL;
+        }
+        buf = malloc(sizeof(ResponseBuf) + len);
+        if (!buf || peer_recv_all(fd, buf->data, len, deadline) < 0) {
+            free(buf);
+            peer_checkin(owner, fd, 0);
+            return NULL;
         }
+        buf->refcount = 1;
+        buf->len = len;
+    }
+    peer_checkin(owner, fd, 1);
+    return buf;
+}
 
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(selected_server.port);
-        inet_pton(AF_INET, selected_server.ip, &server_addr.sin_addr);
+// 백엔드에서 받은 응답을 키를 맡은 피어에 저장 (응답을 기다리지 않음)
+void peer_store(const char* key, const char* value, int len) {
+    if (!PEER_CACHE || strlen(key) > 0xffff) {
+        return;
+    }
+    int owner = peer_owner(key);
+    if (owner == self_index) {
+        cache_add(&peer_cache, key, value, len);
+        return;
+    }
+    int fd = peer_checkout(owner, now_ms() + PEER_TIMEOUT_MS);
+    if (fd < 0) {
+        return;
+    }
+    peer_checkin(owner, fd, peer_send(fd, PEER_PUT, key, value, len) == 0);
+}
 
-        if (connect(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-            perror("Server connect failed");
-            close(client_socket);
-            close(server_socket);
+// 피어 연결 하나 처리 (풀 연결이라 여러 요청이 이어짐)
+void* peer_connection(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    peer_header header;
+    char key[1024];
+    char* value = NULL;
+    int authenticated = 0;
+    while (recv(fd, &header, sizeof(header), MSG_WAITALL) == sizeof(header)) {
+        int key_len = ntohs(header.key_len);
+        int value_len = ntohl(header.value_len);
+        if (key_len >= (int)sizeof(key) || value_len < 0 || value_len > MAX_ENTRY_SIZE ||
+            recv(fd, key, key_len, MSG_WAITALL) != key_len) {
+            break;
+        }
+        key[key_len] = '\0';
+        if (!authenticated) {
+            // 첫 메시지가 올바른 HELLO가 아니면 끊음
+            if (header.op != PEER_HELLO || strcmp(key, PEER_SECRET) != 0) {
+                fprintf(stderr, "Peer authentication failed\n");
+                break;
+            }
+            authenticated = 1;
+        }
+        else if (header.op == PEER_GET) {
+            ResponseBuf* buf = cache_search(&peer_cache, key);
+            peer_header reply = { PEER_GET, buf ? PEER_HIT : PEER_MISS, 0, htonl(buf ? buf->len : 0) };
+            int ok = send_all(fd, (char*)&reply, sizeof(reply)) > 0 && (!buf || send_all(fd, buf->data, buf->len) > 0);
+            if (buf) buf_release(buf);
+            if (!ok) break;
+        }
+        else if (header.op == PEER_PUT) {
+            value = realloc(value, value_len + 1);
+            if (!value || recv(fd, value, value_len, MSG_WAITALL) != value_len) {
+                break;
+            }
+            cache_add(&peer_cache, key, value, value_len);
+        }
+        else {
+            break;
+        }
+    }
+    free(value);
+    close(fd);
+    return NULL;
+}
+
+// 피어 요청 수신 스레드
+void* peer_server(void* arg) {
+    int server_socket = (int)(intptr_t)arg;
+    while (1) {
+        int fd = accept(server_socket, NULL, NULL);
+        if (fd < 0) {
+            perror("Peer accept failed");
+            continue;
+        }
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, peer_connection, (void*)(intptr_t)fd) != 0) {
+            close(fd);
             continue;
         }
+        pthread_detach(tid);
+    }
+    return NULL;
+}
 
-    
-        send(server_socket, buffer, bytes_received, 0);
+// 요청 하나 처리 (클라이언트 소켓은 호출한 쪽에서 타이머 해제 후 닫음)
+void process_request(int client_socket, const client_request* req, timer* total, timer* phase) {
+    char buffer[REQUEST_SIZE];
+    int bytes_received = req->request_len;
+    if (bytes_received > 0) {
+        memcpy(buffer, req->request, bytes_received);
+    }
+    else {
+        timer_arm(phase, IDLE_TIMEOUT_MS, client_socket, -1, TIMEOUT_IDLE);
+        bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
+        timer_cancel(phase);
+    }
+    if (bytes_received <= 0) {
+        if (!check_timeout(total, phase)) perror("recv from client failed");
+        return;
+    }
+    buffer[bytes_received] = '\0';
 
-    
-        bytes_received = recv(server_socket, buffer, sizeof(buffer) - 1, 0);
-        if (bytes_received > 0) {
-            buffer[bytes_received] = '\0';
-            send(client_socket, buffer, bytes_received, 0);
+    // 캐시 확인
+    ResponseBuf* cached_response = cache_search(&local_shard->cache, buffer);
+    if (!cached_response) {
+        cached_response = peer_lookup(buffer);
+        if (cached_response) {
+            cache_add(&local_shard->cache, buffer, cached_response->data, cached_response->len);
+        }
+    }
+    if (cached_response) {
+        // 캐시 응답 반환 (복사 없이 참조로 전송)
+        timer_arm(phase, IDLE_TIMEOUT_MS, client_socket, -1, TIMEOUT_IDLE);
+        if (send_all(client_socket, cached_response->data, cached_response->len) < 0) {
+            check_timeout(total, phase);
+        }
+        timer_cancel(phase);
+        buf_release(cached_response);
+        return;
+    }
+
+    // 로드밸런싱 (한도가 남은 백엔드가 없으면 503)
+    int probe = 0;
+    int server_index = backend_acquire(&probe);
+    if (server_index < 0) {
+        send(client_socket, overload_response, sizeof(overload_response) - 1, MSG_NOSIGNAL);
+        return;
+    }
+    server_info selected_server = web_servers[server_index];
+    long start_ms = now_ms();
+    int server_socket;
+    struct sockaddr_in server_addr;
+    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket < 0) {
+        perror("Socket creation failed for server");
+        backend_release(server_index, 0, 1, probe);
+        return;
+    }
+    timer_attach(total, server_socket);
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(selected_server.port);
+    inet_pton(AF_INET, selected_server.ip, &server_addr.sin_addr);
+
+    timer_arm(phase, CONNECT_TIMEOUT_MS, server_socket, -1, TIMEOUT_CONNECT);
+    int connected = connect(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr));
+    timer_cancel(phase);
+    if (connected < 0) {
+        if (!check_timeout(total, phase)) perror("Server connect failed");
+        backend_release(server_index, now_ms() - start_ms, 0, probe);
+        timer_attach(total, -1);
+        close(server_socket);
+        return;
+    }
 
-            // 응답 캐시에 저장
-            cache_add(buffer, buffer);
+    send(server_socket, buffer, bytes_received, MSG_NOSIGNAL);
+
+    // 첫 응답 대기
+    char response[MAX_ENTRY_SIZE];
+    timer_arm(phase, FIRST_BYTE_TIMEOUT_MS, server_socket, -1, TIMEOUT_FIRST_BYTE);
+    int response_len = recv(server_socket, response, sizeof(response), 0);
+    timer_cancel(phase);
+    backend_release(server_index, now_ms() - start_ms, response_len > 0, probe);
+    if (response_len > 0) {
+        timer_arm(phase, IDLE_TIMEOUT_MS, client_socket, -1, TIMEOUT_IDLE);
+        if (send_all(client_socket, response, response_len) < 0) {
+            check_timeout(total, phase);
         }
-        else {
-            perror("recv from server failed");
+        timer_cancel(phase);
+
+        // 응답 캐시에 저장 (키는 요청)
+        cache_add(&local_shard->cache, buffer, response, response_len);
+        peer_store(buffer, response, response_len);
+    }
+    else if (!check_timeout(total, phase)) {
+        perror("recv from server failed");
+    }
+
+    timer_attach(total, -1);
+    close(server_socket);
+}
+
+// 현재 스레드를 cpu에 고정
+void pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+        fprintf(stderr, "pin to cpu %d failed: %s\n", cpu, strerror(err));
+    }
+}
+
+void* handle_client(void* arg) {
+    local_shard = arg;
+    if (CPU_AFFINITY) pin_to_cpu(local_shard->cpu);
+    timer total = { .slot = -1 };
+    timer phase = { .slot = -1 };
+    while (1) {
+        int shed;
+        client_request req;
+        int client_socket = dequeue(&shed, &req);
+        if (req.pending) {
+            // accept 스레드가 보내다 만 캐시 히트: 이미 응답을 시작했으므로 버리지 않고 나머지 전송
+            timer_arm(&phase, IDLE_TIMEOUT_MS, client_socket, -1, TIMEOUT_IDLE);
+            send_all(client_socket, req.pending->data + req.pending_sent, req.pending->len - req.pending_sent);
+            timer_cancel(&phase);
+            buf_release(req.pending);
+            close(client_socket);
+            continue;
+        }
+        if (shed) {
+            reject_overload(client_socket);
+            continue;
         }
 
+        timer_arm(&total, TOTAL_TIMEOUT_MS, client_socket, -1, TIMEOUT_TOTAL);
+        process_request(client_socket, &req, &total, &phase);
+        timer_cancel(&total);
         close(client_socket);
-        close(server_socket);
     }
     return NULL;
 }
 
-int main() {
-    int server_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
+// 샤드 accept 스레드에서 요청이 이미 와 있으면 읽고, 로컬 캐시 히트면 바로 응답 (처리했으면 1)
+// 피어 조회와 백엔드 요청은 기다려야 하므로 워커로 넘기고, 읽은 요청은 request/request_len으로 돌려줌
+// 송신은 MSG_DONTWAIT라 accept 스레드가 막히지 않고, 클라이언트 수신 윈도가 작아 다 못 보내면 나머지는 워커로 넘김
+int serve_inline(int client_socket, char* request, int* request_len) {
+    *request_len = 0;
+    int n = recv(client_socket, request, REQUEST_SIZE - 1, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    if (n <= 0) {
+        close(client_socket);
+        return 1;
+    }
+    request[n] = '\0';
+    *request_len = n;
 
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    ResponseBuf* cached_response = cache_search(&local_shard->cache, request);
+    if (!cached_response) {
+        return 0;
+    }
+    int sent = send(client_socket, cached_response->data, cached_response->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        sent = 0;
+    }
+    // 수신 윈도가 작아 다 못 보냈으면 나머지는 워커가 기다리며 보냄 (참조는 큐로 넘어감)
+    if (sent >= 0 && sent < cached_response->len && enqueue(client_socket, request, 0, cached_response, sent) == 0) {
+        return 1;
+    }
+    buf_release(cached_response);
+    close(client_socket);
+    return 1;
+}
+
+// 샤드 수와 각 샤드의 cpu 결정 (프로세스가 쓸 수 있는 cpu 순서대로)
+void init_shards() {
+    cpu_set_t set;
+    num_shards = 0;
+    if (CPU_AFFINITY && sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE && num_shards < MAX_SHARDS; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                shard_cpus[num_shards++] = cpu;
+            }
+        }
+    }
+    if (num_shards == 0) {
+        shard_cpus[0] = 0;
+        num_shards = 1;
+    }
+}
+
+int create_listen_socket(const char* ip, int port, int cpu) {
+    struct sockaddr_in server_addr;
+    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket < 0) {
         perror("Socket creation failed");
         return -1;
     }
 
+    int on = 1;
+    if (cpu >= 0 && num_shards > 1) {
+        // 같은 포트에 샤드 수만큼 리스닝 소켓
+        if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            perror("SO_REUSEPORT failed");
+        }
+        // 이 cpu에서 받은 연결을 선호
+        if (setsockopt(server_socket, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0) {
+            perror("SO_INCOMING_CPU failed");
+        }
+    }
+
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(LISTENPORT);
+    if (ip && inet_pton(AF_INET, ip, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "Bad listen address %s\n", ip);
+        close(server_socket);
+        return -1;
+    }
+    server_addr.sin_port = htons(port);
 
     if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         perror("Bind failed");
@@ -260,21 +1044,169 @@ int main() {
         close(server_socket);
         return -1;
     }
+    return server_socket;
+}
 
-    pthread_t workers[4];
-    for (int i = 0; i < 4; i++) {
-        pthread_create(&workers[i], NULL, handle_client, NULL);
+// 연결을 처리한 cpu 번호로 리스닝 소켓 선택 (소켓 번호 = 바인드 순서 = 샤드 번호)
+// cpu 번호를 shard_cpus[]에서 찾아 그 샤드로 보냄 (허용 cpu가 0부터 연속이 아니어도 같은 코어의 샤드로 감)
+// 샤드가 없는 cpu에서 처리된 패킷은 cpu 번호 % 샤드 수
+void attach_cpu_steering(int server_socket) {
+    struct sock_filter code[2 * MAX_SHARDS + 3];
+    int n = 0;
+    code[n++] = (struct sock_filter){ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU };
+    for (int i = 0; i < num_shards; i++) {
+        code[n++] = (struct sock_filter){ BPF_JMP | BPF_JEQ | BPF_K, 0, 1, shard_cpus[i] };
+        code[n++] = (struct sock_filter){ BPF_RET | BPF_K, 0, 0, i };
+    }
+    code[n++] = (struct sock_filter){ BPF_ALU | BPF_MOD | BPF_K, 0, 0, num_shards };
+    code[n++] = (struct sock_filter){ BPF_RET | BPF_A, 0, 0, 0 };
+    struct sock_fprog prog = { .len = n, .filter = code };
+    if (setsockopt(server_socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        perror("SO_ATTACH_REUSEPORT_CBPF failed");
+    }
+}
+
+// 샤드 accept 스레드: cpu에 고정한 뒤 샤드 상태를 할당(first touch)하고 워커 생성
+void* shard_thread(void* arg) {
+    int index = (int)(intptr_t)arg;
+    int cpu = shard_cpus[index];
+    if (CPU_AFFINITY) pin_to_cpu(cpu);
+
+    shard* s;
+    if (posix_memalign((void**)&s, CACHE_LINE, sizeof(shard)) != 0) {
+        perror("shard alloc failed");
+        exit(1);
     }
+    memset(s, 0, sizeof(shard));
+    pthread_mutex_init(&s->queue.mutex, NULL);
+    pthread_cond_init(&s->queue.cond_non_empty, NULL);
+    pthread_mutex_init(&s->cache.mutex, NULL);
+    s->cache.capacity = CACHE_SIZE;
+    s->queue.last_empty_ms = now_ms();
+    s->current_server_index = index; // 샤드마다 시작 서버를 달리 함
+    s->index = index;
+    s->cpu = cpu;
+    s->listen_socket = listen_sockets[index];
+    local_shard = s;
+    register_lock(&s->queue.mutex, "shard queue.mutex");
+    register_lock(&s->cache.mutex, "shard cache.mutex");
+    __atomic_store_n(&shards[index], s, __ATOMIC_RELEASE);
 
+    pthread_t workers[NUM_WORKERS];
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        pthread_create(&workers[i], NULL, handle_client, s);
+    }
+
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_len;
     while (1) {
-        int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_addr_len);
+        client_addr_len = sizeof(client_addr);
+        int client_socket = accept(s->listen_socket, (struct sockaddr*)&client_addr, &client_addr_len);
         if (client_socket < 0) {
             perror("Accept failed");
             continue;
         }
-        enqueue(client_socket);
+        char request[REQUEST_SIZE];
+        int request_len = 0;
+        if (INLINE_HITS && serve_inline(client_socket, request, &request_len)) {
+            continue;
+        }
+        if (enqueue(client_socket, request, request_len, NULL, 0) < 0) {
+            reject_overload(client_socket);
+        }
     }
+    return NULL;
+}
 
-    close(server_socket);
+// 타임아웃 횟수와 락 통계 출력 (근사치)
+void write_stats(int fd) {
+    queue_stats usage[MAX_SHARDS];
+    int count = 0;
+    for (int i = 0; i < num_shards; i++) {
+        shard* s = __atomic_load_n(&shards[i], __ATOMIC_ACQUIRE);
+        if (s) usage[count++] = s->queue_usage;
+    }
+    dprintf(fd, "%d shard(s)", num_shards);
+    for (int i = 0; i < 4; i++) {
+        dprintf(fd, ", %s timeouts %ld", timeout_names[i], __atomic_load_n(&timeout_counts[i], __ATOMIC_RELAXED));
+    }
+    dprintf(fd, "\n");
+    write_lock_stats(fd, usage, count);
+}
+
+// SIGUSR2를 받으면 통계를 stdout으로 (다른 스레드는 SIGUSR2를 막아 둠)
+void* stats_thread(void* arg) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+    while (1) {
+        int sig;
+        if (sigwait(&set, &sig) == 0) {
+            fflush(stdout);
+            write_stats(STDOUT_FILENO);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        self_index = atoi(argv[1]);
+        if (self_index < 0 || self_index >= NUM_PEERS) {
+            fprintf(stderr, "usage: %s [peer index 0-%d]\n", argv[0], NUM_PEERS - 1);
+            return -1;
+        }
+    }
+    init_shards();
+
+    // 바인드 순서가 reuseport 그룹 안의 소켓 번호가 되므로 샤드 순서대로 생성
+    for (int i = 0; i < num_shards; i++) {
+        listen_sockets[i] = create_listen_socket(NULL, LISTENPORT + self_index, shard_cpus[i]);
+        if (listen_sockets[i] < 0) {
+            return -1;
+        }
+        // 요청이 도착한 연결만 accept되도록 해서 인라인 처리 때 recv가 기다리지 않게 함
+        if (INLINE_HITS) {
+            int defer_secs = 1;
+            setsockopt(listen_sockets[i], IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_secs, sizeof(defer_secs));
+        }
+    }
+    if (num_shards > 1) {
+        attach_cpu_steering(listen_sockets[0]);
+    }
+    printf("%d shard(s)\n", num_shards);
+
+    register_lock(&limit_lock, "limit_lock");
+    register_lock(&wheel.mutex, "wheel.mutex");
+    register_lock(&peer_cache.mutex, "peer_cache.mutex");
+    // SIGUSR2는 통계 스레드만 받음 (이후 만드는 스레드에 상속)
+    sigset_t stats_signals;
+    sigemptyset(&stats_signals);
+    sigaddset(&stats_signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &stats_signals, NULL);
+    pthread_t stats_tid;
+    pthread_create(&stats_tid, NULL, stats_thread, NULL);
+
+    pthread_t timer_tid;
+    pthread_create(&timer_tid, NULL, timer_thread, NULL);
+
+    if (PEER_CACHE) {
+        build_peer_ring();
+        // 피어 소켓은 샤드로 나누지 않고, 피어 목록의 자기 주소에만 바인드
+        int peer_socket = create_listen_socket(peers[self_index].ip, peers[self_index].port, -1);
+        if (peer_socket < 0) {
+            return -1;
+        }
+        pthread_t peer_tid;
+        pthread_create(&peer_tid, NULL, peer_server, (void*)(intptr_t)peer_socket);
+    }
+
+    pthread_t shard_tids[MAX_SHARDS];
+    for (int i = 0; i < num_shards; i++) {
+        pthread_create(&shard_tids[i], NULL, shard_thread, (void*)(intptr_t)i);
+    }
+    for (int i = 0; i < num_shards; i++) {
+        pthread_join(shard_tids[i], NULL);
+    }
     return 0;
 }
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// hash.c 세션 고정 키 + 부하 제한 일관 해싱 시뮬레이션
+// 사용법: affinity_sim [서버수] [요청수]
+// NAT 뒤에 사용자가 몰린 분포에서 라우팅 키(클라이언트 IP / 세션 쿠키)와 부하 제한 여부에 따라
+// 서버별 동시 처리 수의 최대/평균 비율과 키의 첫 링 서버로 간 요청 비율(세션 고정 유지율)을 출력
+// 링, 서버 선택 순서, 한도 계산은 hash.c의 build_ring / ring_search / load_balance와 같음 (AIMD 한도는 무시)
+
+#define MAX_SERVERS 64
+#define VNODES 100
+#define LOAD_FACTOR 1.25
+#define CONCURRENCY 512 // 동시에 처리 중인 요청 수, 가장 오래된 요청부터 끝남
+#define USERS 100000
+#define NAT_GATEWAYS 20 // NAT 게이트웨이 IP 수, g번째 게이트웨이에 1/(g+1) 비율로 사용자가 몰림
+#define NAT_SHARE 0.6 // NAT 뒤에 있는 사용자 비율
+#define DEFAULT_SERVERS 8
+#define DEFAULT_REQUESTS 2000000
+
+typedef struct {
+    unsigned int hash;
+    int server;
+} ring_point;
+
+ring_point ring[MAX_SERVERS * VNODES];
+int num_servers;
+int ring_size;
+int inflight[MAX_SERVERS];
+int user_gateway[USERS]; // -1이면 자기 IP
+
+unsigned int murmur_hash(char* key) {
+    unsigned int seed = 0x1234abcd;
+    unsigned int m = 0x5bd1e995;
+    unsigned int r = 24;
+    unsigned int len = strlen(key);
+    unsigned int h = seed ^ len;
+    const unsigned char* data = (const unsigned char*)key;
+    while (len >= 4) {
+        unsigned int k = *(unsigned int*)data;
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h *= m;
+        h ^= k;
+        data += 4;
+        len -= 4;
+    }
+    switch (len) {
+    case 3: h ^= data[2] << 16;
+    case 2: h ^= data[1] << 8;
+    case 1: h ^= data[0];
+        h *= m;
+    };
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+    return h;
+}
+
+int compare_ring_point(const void* a, const void* b) {
+    unsigned int x = ((const ring_point*)a)->hash;
+    unsigned int y = ((const ring_point*)b)->hash;
+    return (x > y) - (x < y);
+}
+
+void build_ring() {
+    ring_size = num_servers * VNODES;
+    for (int i = 0; i < num_servers; i++) {
+        for (int v = 0; v < VNODES; v++) {
+            char name[64];
+            snprintf(name, sizeof(name), "10.0.0.%d:%d#%d", i + 1, 9100, v);
+            ring[i * VNODES + v].hash = murmur_hash(name);
+            ring[i * VNODES + v].server = i;
+        }
+    }
+    qsort(ring, ring_size, sizeof(ring_point), compare_ring_point);
+}
+
+int ring_search(unsigned int hash) {
+    int lo = 0, hi = ring_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo % ring_size;
+}
+
+// hash.c load_balance와 같은 순서로 서버 선택, bounded가 0이면 링의 첫 서버 그대로
+// first_server에 키의 첫 링 서버를 돌려줌
+int pick_server(char* key, int bounded, int* first_server) {
+    int pos = ring_search(murmur_hash(key));
+    int order[MAX_SERVERS];
+    int found = 0;
+    unsigned long long seen = 0;
+    for (int i = 0; i < ring_size && found < num_servers; i++) {
+        int server = ring[(pos + i) % ring_size].server;
+        if (!(seen & (1ULL << server))) {
+            seen |= 1ULL << server;
+            order[found++] = server;
+        }
+    }
+    *first_server = order[0];
+    if (!bounded) {
+        return order[0];
+    }
+    int total = 0;
+    for (int i = 0; i < num_servers; i++) {
+        total += inflight[i];
+    }
+    double bound = LOAD_FACTOR * (total + 1) / num_servers;
+    int capacity = (int)bound;
+    if (capacity < bound) capacity++;
+    for (int i = 0; i < found; i++) {
+        if (inflight[order[i]] < capacity) return order[i];
+    }
+    return order[0];
+}
+
+// NAT 게이트웨이 g는 1/(g+1)에 비례하는 몫의 사용자를 가짐
+void assign_users() {
+    double weights[NAT_GATEWAYS];
+    double sum = 0;
+    for (int g = 0; g < NAT_GATEWAYS; g++) {
+        weights[g] = 1.0 / (g + 1);
+        sum += weights[g];
+    }
+    srand(1);
+    for (int u = 0; u < USERS; u++) {
+        user_gateway[u] = -1;
+        if (rand() / (RAND_MAX + 1.0) >= NAT_SHARE) continue;
+        double x = rand() / (RAND_MAX + 1.0) * sum;
+        int g = 0;
+        while (g < NAT_GATEWAYS - 1 && (x -= weights[g]) >= 0) g++;
+        user_gateway[u] = g;
+    }
+}
+
+void make_key(int user, int by_cookie, char* key, int key_size) {
+    if (by_cookie) snprintf(key, key_size, "sess-%08x-%d", user * 2654435761u, user);
+    else if (user_gateway[user] >= 0) snprintf(key, key_size, "203.0.113.%d", user_gateway[user] + 1);
+    else snprintf(key, key_size, "10.%d.%d.%d", user >> 16, (user >> 8) & 255, user & 255);
+}
+
+void simulate(const char* name, int by_cookie, int bounded, long requests) {
+    int window[CONCURRENCY];
+    int oldest = 0;
+    long affine = 0;
+    long samples = 0;
+    double ratio_sum = 0;
+    double ratio_peak = 0;
+    memset(inflight, 0, sizeof(inflight));
+    srand(2);
+    for (long n = 0; n < requests; n++) {
+        if (n >= CONCURRENCY) {
+            inflight[window[oldest]]--;
+        }
+        char key[64];
+        int first_server;
+        make_key(rand() % USERS, by_cookie, key, sizeof(key));
+        int server = pick_server(key, bounded, &first_server);
+        inflight[server]++;
+        window[oldest] = server;
+        oldest = (oldest + 1) % CONCURRENCY;
+        affine += server == first_server;
+        if (n >= CONCURRENCY) {
+            int max = 0;
+            for (int i = 0; i < num_servers; i++) {
+                if (inflight[i] > max) max = inflight[i];
+            }
+            double ratio = max * (double)num_servers / CONCURRENCY;
+            ratio_sum += ratio;
+            if (ratio > ratio_peak) ratio_peak = ratio;
+            samples++;
+        }
+    }
+    printf("%-18s max/avg mean %5.2f peak %5.2f  affinity kept %6.2f%%\n", name,
+        ratio_sum / samples, ratio_peak, affine * 100.0 / requests);
+}
+
+int main(int argc, char** argv) {
+    num_servers = argc > 1 ? atoi(argv[1]) : DEFAULT_SERVERS;
+    long requests = argc > 2 ? atol(argv[2]) : DEFAULT_REQUESTS;
+    if (num_servers < 1 || num_servers > MAX_SERVERS || requests <= CONCURRENCY) {
+        fprintf(stderr, "usage: %s [servers 1-%d] [requests > %d]\n", argv[0], MAX_SERVERS, CONCURRENCY);
+        return 1;
+    }
+    build_ring();
+    assign_users();
+    int behind_nat = 0;
+    int largest = 0;
+    for (int u = 0; u < USERS; u++) {
+        behind_nat += user_gateway[u] >= 0;
+        largest += user_gateway[u] == 0;
+    }
+    printf("%d servers, %d users (%.0f%% behind %d NAT gateways, largest %.1f%%), %d in flight, c=%.2f\n",
+        num_servers, USERS, behind_nat * 100.0 / USERS, NAT_GATEWAYS, largest * 100.0 / USERS, CONCURRENCY, LOAD_FACTOR);
+
+    simulate("ip, plain ring", 0, 0, requests);
+    simulate("ip, bounded", 0, 1, requests);
+    simulate("cookie, plain ring", 1, 0, requests);
+    simulate("cookie, bounded", 1, 1, requests);
+    return 0;
+}
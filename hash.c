@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // struct ucred (SO_PEERCRED)
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,8 +6,21 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h> // shm_open:  glibc -lrt
+#include <stdint.h>
+#include <signal.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #define LISTENPORT 8080
 #define PORTNUM 9100
@@ -14,29 +28,176 @@
 #define NUM_SERVERS 2
 #define QUEUE_SIZE 20
 #define BUFFER_SIZE 4096
+#define CACHE_SIZE 5
+#define NUM_WORKERS 5
+#define INLINE_HITS 1 // accept 尡 ̹  û о ĳ Ʈ  , ̽ Ŀ
+
+//  ڵ庰 ĳ: 200/203/301 CACHE_TTL_MS, 404/410 NEG_CACHE_TTL_MS  , 5xx     
+#define CACHE_TTL_MS 30000
+#define NEG_CACHE_TTL_MS 5000
+#define STALE_IF_ERROR_MS 300000 //    ð ̸ 鿣 ( , 5xx)    
+
+// ߴ ׷̵:  μ UPGRADE_DIR   μ ϸ
+//  μ   ѱ(SCM_RIGHTS)  û ó  
+// ͸    0700̾ ϰ,   밡  uid SO_PEERCRED Ȯ
+#define UPGRADE_DIR "/tmp/hash_lb-%d" // %d  uid
+#define UPGRADE_SOCKET_NAME "upgrade.sock"
+#define DRAIN_TIMEOUT_MS 10000
+#define SHM_CACHE 1 // ĳõ  ޸𸮷 ѱ
+#define SHM_CACHE_NAME "/hash_lb_cache-%d" // %d  uid, ٸ ڰ ̸  ׸Ʈ  
+
+// û  ð : Ŀ  ۿ װ SIGUSR1  TRACE_FILE 
+// м trace_report.c
+#define TRACE 1
+#define TRACE_SAMPLE_RATE 1 // N û ϳ 
+#define TRACE_RING_SIZE 4096 // 2 ŵ
+#define TRACE_FILE "hash_trace.bin"
+#define TRACE_MAGIC 0x43525448 // "HTRC"
+#define TRACE_RINGS (NUM_WORKERS + 1) //   accept  (ζ Ʈ)
+
+//  ,  i ts[i] ts[i + 1] (ġ   0)
+#define MARK_ACCEPT 0
+#define MARK_DEQUEUE 1
+#define MARK_RECV 2
+#define MARK_CACHE 3 // cache_lock  ĳ ȸ
+#define MARK_CONNECT 4
+#define MARK_UPSTREAM 5 // û  ~  
+#define MARK_DONE 6 // Ŭ̾Ʈ 
+#define NUM_MARKS 7
+
+//  
+#define TARGET_DELAY_MS 5 //  ¿ ϴ ť  ð
+#define INTERVAL_MS 100 // ť  ð      Ϸ Ǵ
+#define LATENCY_TARGET_MS 200 // 鿣  ̺   ó ѵ 
+#define MIN_LIMIT 1.0
+#define MAX_LIMIT 64.0
+
+//   Ű
+#define AFFINITY_IP 0
+#define AFFINITY_COOKIE 1
+#define AFFINITY_HEADER 2
+#define AFFINITY_URL 3 // URL  鿣带  鿣 ĳÿ 纻 ϳ 
+#define AFFINITY_MODE AFFINITY_COOKIE // Ű//URL  û Ŭ̾Ʈ IP 
+#define AFFINITY_COOKIE_NAME "SESSIONID"
+#define AFFINITY_HEADER_NAME "X-Session-Id"
+
+//   ϰ ؽ
+#define VNODES 100 //  ؽ    
+#define RING_SIZE (NUM_SERVERS * VNODES)
+#define LOAD_FACTOR 1.25 //  ϳ   c踦  ʵ
+
+// α URL  (count-min sketch), α URL  HOT_REPLICAS   
+#define SKETCH_DEPTH 4
+#define SKETCH_WIDTH 4096
+#define SKETCH_WINDOW 10000 // ̸ŭ   ī͸  ٿ  α 
+#define HOT_THRESHOLD 100
+#define HOT_REPLICAS 2
+
+// Ŭ̾Ʈ û  (ū Ŷ), accept  ť ֱ  ˻
+#define RATE_LIMIT 1
+#define RATE_PER_IP 50 // ʴ  
+#define BURST_PER_IP 100
+#define PREFIX_BITS 24 //  /24 뿪  
+#define RATE_PER_PREFIX 500
+#define BURST_PER_PREFIX 1000 // 16777  (ū 24Ʈ)
+#define LIMIT_SHARDS 16
+#define LIMIT_SHARD_SLOTS 16384 // 2 ŵ, ޸𸮴 LIMIT_SHARDS * LIMIT_SHARD_SLOTS * 16Ʈ 
+#define LIMIT_PROBE 8 //    ĭ      ׸ о
+#define BUCKET_TIME_MASK ((1ULL << 40) - 1)
+
+//  : -DLOCK_STATS ϸ LOCK/UNLOCK/COND_WAIT  ؽ / ð , SIGUSR2 
+#include "lock_stats.h"
 
 typedef struct {
     char ip[16];
     int port;
 } server_info;
 
+// ĳ   (   ,  īƮ )
+typedef struct {
+    int refcount;
+    int len;
+    char data[];
+} ResponseBuf;
+
 typedef struct {
     int client_socket;
+    long enqueued_ms; // ť  ð 
+    uint64_t accept_tsc; // Ʈ̽
+    int request_len; // accept 尡 ̹  û , 0̸ Ŀ recv
+    ResponseBuf* pending; // accept 尡    ĳ  ( ϳ Ѱܹ), Ŀ  
+    int pending_sent;
+    char request[BUFFER_SIZE];
 } client_request;
 
+// Ʈ̽   (64Ʈ), trace_report.c  ġ
+typedef struct {
+    uint64_t ts[NUM_MARKS]; // trace_clock() 
+    uint32_t worker;
+    uint32_t hit;
+} trace_record;
+
+// Ŀ ϳ    ϳ д   ( )
+typedef struct {
+    trace_record records[TRACE_RING_SIZE];
+    unsigned long head; // Ŀ 
+    unsigned long tail; //  常 
+    unsigned long dropped; //     
+} trace_ring;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    double ticks_per_us;
+} trace_file_header;
+
 typedef struct {
     client_request requests[QUEUE_SIZE];
     int front, rear, count;
+    long last_empty_ms; // ť   ִ ð (ٰ û   )
     pthread_mutex_t mutex;
     pthread_cond_t cond_non_empty;
-    pthread_cond_t cond_non_full;
 } request_queue;
 
+// ׷̵  ѱ ĳ ( ޸ ġ)
+typedef struct {
+    int count;
+    struct {
+        char key[256];
+        int len;
+        long expires_ms; // CLOCK_MONOTONIC̶ μ ٲ ȿ
+        char data[BUFFER_SIZE];
+    } entries[CACHE_SIZE];
+} shm_cache;
+
 typedef struct {
     char key[256];
-    char value[BUFFER_SIZE];
+    ResponseBuf* value;
+    long expires_ms; //  ׸ STALE_IF_ERROR_MS   
 } CacheEntry;
 
+// 鿣庰  ó ѵ (AIMD)
+typedef struct {
+    int inflight;
+    double limit;
+} backend_limit;
+
+typedef struct {
+    unsigned int hash;
+    int server;
+} ring_point;
+
+// ū Ŷ  ĭ, state  24Ʈ ū(1/1000 ) +  40Ʈ   ð(ms)
+// state 0̸  ŵ Ͱ    Ŷ 
+typedef struct {
+    uint64_t key; // 0̸  ĭ
+    uint64_t state;
+} rate_slot;
+
+typedef struct {
+    rate_slot slots[LIMIT_SHARD_SLOTS];
+} __attribute__((aligned(64))) rate_shard;
+
 server_info web_servers[] = {
     {"10.198.138.212", PORTNUM},
     {"10.198.138.213", PORTNUM}
@@ -47,15 +208,48 @@ request_queue queue = {
     .rear = 0,
     .count = 0,
     .mutex = PTHREAD_MUTEX_INITIALIZER,
-    .cond_non_empty = PTHREAD_COND_INITIALIZER,
-    .cond_non_full = PTHREAD_COND_INITIALIZER
+    .cond_non_empty = PTHREAD_COND_INITIALIZER
+};
+queue_stats queue_usage;
+
+backend_limit limits[NUM_SERVERS] = {
+    {0, NUM_WORKERS},
+    {0, NUM_WORKERS}
 };
+pthread_mutex_t limit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+ring_point ring[RING_SIZE]; // hash  
+unsigned int replica_counter = 0; // α URL 纻   κ
+
+unsigned int sketch[SKETCH_DEPTH][SKETCH_WIDTH];
+unsigned int sketch_samples = 0;
 
+rate_shard rate_table[LIMIT_SHARDS];
 
-CacheEntry cache[5]; 
+const char overload_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+
+const char rate_limited_response[] =
+    "HTTP/1.1 429 Too Many Requests\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+
+CacheEntry cache[CACHE_SIZE];
 int cache_count = 0;
 pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
+int listen_socket = -1;
+int draining = 0; //  ѱ  1, accept ߴ
+int busy_workers = 0; // û ó  Ŀ  (queue.mutex ȣ)
+__thread int worker_busy = 0;
+
+trace_ring trace_rings[TRACE_RINGS];
+double trace_ticks_per_us = 1000.0;
+
 unsigned int murmur_hash(char* key) {
     unsigned int seed = 0x1234abcd;
     unsigned int m = 0x5bd1e995;
@@ -82,71 +276,842 @@ unsigned int murmur_hash(char* key) {
     h ^= h >> 13;
     h *= m;
     h ^= h >> 15;
-    return h % NUM_SERVERS;
+    return h;
+}
+
+int compare_ring_point(const void* a, const void* b) {
+    unsigned int x = ((const ring_point*)a)->hash;
+    unsigned int y = ((const ring_point*)b)->hash;
+    return (x > y) - (x < y);
+}
+
+//  VNODES  ؽ  ġ
+void build_ring() {
+    for (int i = 0; i < NUM_SERVERS; i++) {
+        for (int v = 0; v < VNODES; v++) {
+            char name[64];
+            snprintf(name, sizeof(name), "%s:%d#%d", web_servers[i].ip, web_servers[i].port, v);
+            ring[i * VNODES + v].hash = murmur_hash(name);
+            ring[i * VNODES + v].server = i;
+        }
+    }
+    qsort(ring, RING_SIZE, sizeof(ring_point), compare_ring_point);
+}
+
+// hash ̻ ù  ġ ( 0 ư)
+int ring_search(unsigned int hash) {
+    int lo = 0, hi = RING_SIZE;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo % RING_SIZE;
+}
+
+//   ϰ ؽ: Ű ġ ð    
+// ϰ  LOAD_FACTOR ̸̰  ó ѵ  ù   ڸ Ȯ,  -1
+// replicas > 1̸  replicas  ư ù ĺ 
+int load_balance(char* key, int replicas) {
+    int pos = ring_search(murmur_hash(key));
+    int order[NUM_SERVERS];
+    int found = 0;
+    int seen = 0;
+    for (int i = 0; i < RING_SIZE && found < NUM_SERVERS; i++) {
+        int server = ring[(pos + i) % RING_SIZE].server;
+        if (!(seen & (1 << server))) {
+            seen |= 1 << server;
+            order[found++] = server;
+        }
+    }
+    if (replicas > found) replicas = found;
+    int first = replicas > 1 ? __atomic_fetch_add(&replica_counter, 1, __ATOMIC_RELAXED) % replicas : 0;
+
+    LOCK(&limit_lock);
+    int total = 0;
+    for (int i = 0; i < NUM_SERVERS; i++) {
+        total += limits[i].inflight;
+    }
+    double bound = LOAD_FACTOR * (total + 1) / NUM_SERVERS;
+    int capacity = (int)bound;
+    if (capacity < bound) capacity++;
+
+    for (int i = 0; i < found; i++) {
+        int server = i < replicas ? order[(first + i) % replicas] : order[i];
+        if (limits[server].inflight < capacity && limits[server].inflight < (int)limits[server].limit) {
+            limits[server].inflight++;
+            UNLOCK(&limit_lock);
+            return server;
+        }
+    }
+    UNLOCK(&limit_lock);
+    return -1;
+}
+
+unsigned int fnv_hash(const char* key) {
+    unsigned int h = 2166136261u;
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// count-min sketch key ϰ   ȯ
+unsigned int sketch_add(char* key) {
+    unsigned int h1 = murmur_hash(key);
+    unsigned int h2 = fnv_hash(key) | 1;
+    unsigned int estimate = ~0u;
+    for (int i = 0; i < SKETCH_DEPTH; i++) {
+        unsigned int* counter = &sketch[i][(h1 + i * h2) % SKETCH_WIDTH];
+        unsigned int c = __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+        if (c < estimate) estimate = c;
+    }
+    if (__atomic_add_fetch(&sketch_samples, 1, __ATOMIC_RELAXED) % SKETCH_WINDOW == 0) {
+        //   ٸ   Ϻ    ġ 
+        for (int i = 0; i < SKETCH_DEPTH; i++) {
+            for (int j = 0; j < SKETCH_WIDTH; j++) {
+                __atomic_store_n(&sketch[i][j], __atomic_load_n(&sketch[i][j], __ATOMIC_RELAXED) >> 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return estimate;
+}
+
+// Ű    (URL 忡 α URL  )
+int key_replicas(char* key) {
+#if AFFINITY_MODE == AFFINITY_URL
+    if (sketch_add(key) >= HOT_THRESHOLD) return HOT_REPLICAS;
+#endif
+    return 1;
+}
+
+long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//   ð: x86 TSC (ֽ CPU ھ  ȭ invariant TSC),  ܿ ns
+static inline uint64_t trace_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// trace_clock  us ٲٴ  
+void trace_calibrate() {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t t0 = trace_clock();
+    usleep(50000);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t t1 = trace_clock();
+    double us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    trace_ticks_per_us = (t1 - t0) / us;
+}
+
+// Ϸ  ʴ û ٷ 503  
+void reject_overload(int client_socket) {
+    send(client_socket, overload_response, sizeof(overload_response) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(client_socket);
+}
+
+void reject_rate_limited(int client_socket) {
+    send(client_socket, rate_limited_response, sizeof(rate_limited_response) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(client_socket);
+}
+
+static inline uint64_t mix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+//     ū ϰ(ִ burst) ϳ    1
+int bucket_take(rate_slot* slot, long now, int rate, int burst) {
+    uint64_t old = __atomic_load_n(&slot->state, __ATOMIC_RELAXED);
+    for (;;) {
+        uint64_t tokens = old >> 40;
+        uint64_t elapsed = ((uint64_t)now - old) & BUCKET_TIME_MASK;
+        if (elapsed > BUCKET_TIME_MASK / 2 && old != 0) elapsed = 0; // ٸ 尡   ð  
+        tokens += elapsed * rate; // 1ms rate/1000ū
+        if (tokens > (uint64_t)burst * 1000) tokens = (uint64_t)burst * 1000;
+        int allowed = tokens >= 1000;
+        if (allowed) tokens -= 1000;
+        uint64_t next = tokens << 40 | ((uint64_t)now & BUCKET_TIME_MASK);
+        if (__atomic_compare_exchange_n(&slot->state, &old, next, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return allowed;
+        }
+    }
 }
 
-int load_balance(char* client_ip) {
-    return murmur_hash(client_ip);
+// key Ŷ ū ϳ , ó  key   Ŷ  ( )
+int rate_take(uint64_t key, long now, int rate, int burst) {
+    uint64_t h = mix64(key);
+    rate_shard* shard = &rate_table[h % LIMIT_SHARDS];
+    unsigned int index = h >> 32;
+    rate_slot* oldest = NULL;
+    uint64_t oldest_age = 0;
+    for (int i = 0; i < LIMIT_PROBE; i++) {
+        rate_slot* slot = &shard->slots[(index + i) & (LIMIT_SHARD_SLOTS - 1)];
+        uint64_t k = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+        if (k == 0) {
+            if (__atomic_compare_exchange_n(&slot->key, &k, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return bucket_take(slot, now, rate, burst);
+            }
+            // ٸ 尡  , k  key  
+        }
+        if (k == key) {
+            return bucket_take(slot, now, rate, burst);
+        }
+        uint64_t age = ((uint64_t)now - __atomic_load_n(&slot->state, __ATOMIC_RELAXED)) & BUCKET_TIME_MASK;
+        if (!oldest || age > oldest_age) {
+            oldest = slot;
+            oldest_age = age;
+        }
+    }
+    //     ׸ ü, ׵  á Ŷ̸ Ҵ  
+    //  ĭ  key ϴ  ġ ū  Ʋ   ġ 
+    uint64_t victim = __atomic_load_n(&oldest->key, __ATOMIC_ACQUIRE);
+    if (__atomic_compare_exchange_n(&oldest->key, &victim, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&oldest->state, 0, __ATOMIC_RELAXED);
+        return bucket_take(oldest, now, rate, burst);
+    }
+    return 1; // ü ￡  ̹   
+}
+
+// Ŭ̾Ʈ IP  뿪 Ŷ   ū ־ 
+int rate_allow(struct sockaddr_in* addr) {
+    uint32_t ip = ntohl(addr->sin_addr.s_addr);
+    uint32_t prefix = ip & (uint32_t)(~0ULL << (32 - PREFIX_BITS));
+    long now = now_ms();
+    if (!rate_take(1ULL << 32 | ip, now, RATE_PER_IP, BURST_PER_IP)) return 0;
+    return rate_take(2ULL << 32 | prefix, now, RATE_PER_PREFIX, BURST_PER_PREFIX);
 }
 
-void enqueue(int client_socket) {
-    pthread_mutex_lock(&queue.mutex);
-    while (queue.count == QUEUE_SIZE) {
-        pthread_cond_wait(&queue.cond_non_full, &queue.mutex);
+// ť   ٸ ʰ -1 ȯ
+// request_len 0 ũ accept 尡  û Բ ѱ
+// pending  û óư  pending_sent ĸ  
+int enqueue(int client_socket, const char* request, int request_len, ResponseBuf* pending, int pending_sent, uint64_t accept_tsc) {
+    LOCK(&queue.mutex);
+    if (queue.count == QUEUE_SIZE) {
+        queue_usage.full_rejects++;
+        UNLOCK(&queue.mutex);
+        return -1;
+    }
+    long now = now_ms();
+    //  ť ó  û: ݱ  ־Ƿ  Ǵ  ⼭  
+    if (queue.count == 0) {
+        queue.last_empty_ms = now;
     }
     queue.requests[queue.rear].client_socket = client_socket;
+    queue.requests[queue.rear].enqueued_ms = now;
+    queue.requests[queue.rear].accept_tsc = accept_tsc;
+    queue.requests[queue.rear].request_len = request_len;
+    queue.requests[queue.rear].pending = pending;
+    queue.requests[queue.rear].pending_sent = pending_sent;
+    memcpy(queue.requests[queue.rear].request, request, request_len);
+    queue_usage_update(&queue_usage, queue.count);
     queue.rear = (queue.rear + 1) % QUEUE_SIZE;
     queue.count++;
     pthread_cond_signal(&queue.cond_non_empty);
-    pthread_mutex_unlock(&queue.mutex);
+    UNLOCK(&queue.mutex);
+    return 0;
 }
 
-int dequeue() {
-    pthread_mutex_lock(&queue.mutex);
+// CoDel : ť INTERVAL_MS   ʾ TARGET_DELAY_MS Ѱ ٸ û  (*shed = 1)
+// û req ϰ  ȯ
+int dequeue(int* shed, client_request* req) {
+    LOCK(&queue.mutex);
+    // ٽ dequeue θ  û  
+    if (worker_busy) {
+        busy_workers--;
+        worker_busy = 0;
+    }
     while (queue.count == 0) {
-        pthread_cond_wait(&queue.cond_non_empty, &queue.mutex);
+        COND_WAIT(&queue.cond_non_empty, &queue.mutex);
     }
-    int client_socket = queue.requests[queue.front].client_socket;
+    client_request* front = &queue.requests[queue.front];
+    int client_socket = front->client_socket;
+    req->client_socket = client_socket;
+    req->accept_tsc = front->accept_tsc;
+    req->request_len = front->request_len;
+    req->pending = front->pending;
+    req->pending_sent = front->pending_sent;
+    memcpy(req->request, front->request, front->request_len);
+    long now = now_ms();
+    long sojourn = now - front->enqueued_ms;
+    long max_delay = now - queue.last_empty_ms > INTERVAL_MS ? TARGET_DELAY_MS : INTERVAL_MS;
+    *shed = sojourn > max_delay;
+    queue_usage_update(&queue_usage, queue.count);
     queue.front = (queue.front + 1) % QUEUE_SIZE;
     queue.count--;
-    pthread_cond_signal(&queue.cond_non_full);
-    pthread_mutex_unlock(&queue.mutex);
+    if (queue.count == 0) {
+        queue.last_empty_ms = now;
+    }
+    busy_workers++;
+    worker_busy = 1;
+    UNLOCK(&queue.mutex);
     return client_socket;
 }
 
-int check_cache(char* key, char* value) {
-    pthread_mutex_lock(&cache_lock);
+//  ð ѵ :  ݾ ø ų ϸ 
+void backend_release(int server_index, long latency_ms, int ok) {
+    LOCK(&limit_lock);
+    backend_limit* l = &limits[server_index];
+    l->inflight--;
+    if (ok && latency_ms <= LATENCY_TARGET_MS) {
+        l->limit += 1.0 / l->limit;
+        if (l->limit > MAX_LIMIT) l->limit = MAX_LIMIT;
+    }
+    else {
+        l->limit *= 0.9;
+        if (l->limit < MIN_LIMIT) l->limit = MIN_LIMIT;
+    }
+    UNLOCK(&limit_lock);
+}
+
+//   ã (ҹ ), ã 1 ȯ
+int find_header(const char* head, const char* name, char* value, int value_size) {
+    int name_len = strlen(name);
+    const char* line = strstr(head, "\r\n");
+    while (line && strncmp(line, "\r\n\r\n", 4) != 0) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char* v = line + name_len + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            int len = strcspn(v, "\r\n");
+            if (len >= value_size) len = value_size - 1;
+            memcpy(value, v, len);
+            value[len] = '\0';
+            return 1;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return 0;
+}
+
+// Cookie  name  ã
+int find_cookie(const char* request, const char* name, char* value, int value_size) {
+    char cookies[1024];
+    if (!find_header(request, "Cookie", cookies, sizeof(cookies))) {
+        return 0;
+    }
+    int name_len = strlen(name);
+    char* c = cookies;
+    while (c) {
+        while (*c == ' ' || *c == ';') c++;
+        if (strncmp(c, name, name_len) == 0 && c[name_len] == '=') {
+            c += name_len + 1;
+            int len = strcspn(c, ";");
+            if (len == 0) return 0;
+            if (len >= value_size) len = value_size - 1;
+            memcpy(value, c, len);
+            value[len] = '\0';
+            return 1;
+        }
+        c = strchr(c, ';');
+    }
+    return 0;
+}
+
+// û URL ȭ:  URL scheme://host , ӵ / ħ, #fragment  ? 
+int normalize_url(const char* request, char* key, int key_size) {
+    char url[1024];
+    if (sscanf(request, "%*s %1023s", url) != 1) {
+        return 0;
+    }
+    const char* p = url;
+    if (strncasecmp(p, "http://", 7) == 0 || strncasecmp(p, "https://", 8) == 0) {
+        p = strchr(strstr(p, "://") + 3, '/');
+        if (!p) p = "/";
+    }
+    int len = 0;
+    int in_query = 0;
+    for (; *p && *p != '#' && len < key_size - 1; p++) {
+        if (*p == '?') in_query = 1;
+        if (!in_query && *p == '/' && len > 0 && key[len - 1] == '/') continue;
+        key[len++] = *p;
+    }
+    if (len > 0 && key[len - 1] == '?') len--;
+    key[len] = '\0';
+    return len > 0;
+}
+
+//  Ű:  Ű,  URL   ,  Ŭ̾Ʈ IP
+void affinity_key(const char* request, const char* client_ip, char* key, int key_size) {
+#if AFFINITY_MODE == AFFINITY_URL
+    if (normalize_url(request, key, key_size)) return;
+#elif AFFINITY_MODE == AFFINITY_COOKIE
+    if (find_cookie(request, AFFINITY_COOKIE_NAME, key, key_size)) return;
+#elif AFFINITY_MODE == AFFINITY_HEADER
+    if (find_header(request, AFFINITY_HEADER_NAME, key, key_size)) return;
+#endif
+    snprintf(key, key_size, "%s", client_ip);
+}
+
+ResponseBuf* buf_create(const char* data, int len) {
+    ResponseBuf* buf = malloc(sizeof(ResponseBuf) + len);
+    if (!buf) {
+        return NULL;
+    }
+    buf->refcount = 1;
+    buf->len = len;
+    memcpy(buf->data, data, len);
+    return buf;
+}
+
+void buf_retain(ResponseBuf* buf) {
+    __atomic_add_fetch(&buf->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void buf_release(ResponseBuf* buf) {
+    if (__atomic_sub_fetch(&buf->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(buf);
+    }
+}
+
+// Ʈ     ,   buf_release ʿ
+// allow_stale̸   STALE_IF_ERROR_MS  ׸ ȯ
+ResponseBuf* check_cache(char* key, int allow_stale) {
+    long now = now_ms();
+    LOCK(&cache_lock);
     for (int i = 0; i < cache_count; i++) {
         if (strcmp(cache[i].key, key) == 0) {
-            strcpy(value, cache[i].value);
-            pthread_mutex_unlock(&cache_lock);
-            return 1;         
+            if (now >= cache[i].expires_ms + (allow_stale ? STALE_IF_ERROR_MS : 0)) {
+                break;
+            }
+            ResponseBuf* buf = cache[i].value;
+            buf_retain(buf);
+            UNLOCK(&cache_lock);
+            return buf;
         }
     }
-    pthread_mutex_unlock(&cache_lock);
-    return 0; 
+    UNLOCK(&cache_lock);
+    return NULL;
 }
 
-void update_cache(char* key, char* value) {
-    pthread_mutex_lock(&cache_lock);
-    if (cache_count < 10) {
-        strcpy(cache[cache_count].key, key);
-        strcpy(cache[cache_count].value, value);
-        cache_count++;
+void update_cache(char* key, char* value, int len, long expires_ms) {
+    //   ۿ
+    ResponseBuf* buf = buf_create(value, len);
+    if (!buf) {
+        return;
     }
-    else {
 
-        //ó ĳ ü
+    LOCK(&cache_lock);
+    //  ׸      Ű ü
+    int i;
+    for (i = 0; i < cache_count; i++) {
+        if (strcmp(cache[i].key, key) == 0) {
+            break;
+        }
+    }
+    if (i == cache_count) {
+        if (cache_count < CACHE_SIZE) {
+            cache_count++;
+        }
+        else {
+
+            //ó ĳ ü
+
+            i = 0;
+        }
+    }
+    strcpy(cache[i].key, key);
+    ResponseBuf* old = cache[i].value;
+    cache[i].value = buf;
+    cache[i].expires_ms = expires_ms;
+    UNLOCK(&cache_lock);
 
-        strcpy(cache[0].key, key);
-        strcpy(cache[0].value, value);
+    //   尡      free
+    if (old) {
+        buf_release(old);
     }
-    pthread_mutex_unlock(&cache_lock);
 }
 
+int send_all(int sock, const char* data, int len) {
+    int sent = 0;
+    while (sent < len) {
+        int n = send(sock, data + sent, len - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return -1;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+//   ڵ (   0)
+int response_status(const char* response) {
+    int status = 0;
+    sscanf(response, "HTTP/%*s %d", &status);
+    return status;
+}
+
+//   ޾Ұ Content-Length chunked    ޾ 1
+//      (eof) 
+int response_complete(const char* response, int len, int eof) {
+    const char* head_end = strstr(response, "\r\n\r\n");
+    if (!head_end) {
+        return 0;
+    }
+    char value[64];
+    if (find_header(response, "Content-Length", value, sizeof(value))) {
+        return len - (head_end + 4 - response) == atol(value);
+    }
+    if (find_header(response, "Transfer-Encoding", value, sizeof(value))) {
+        return len >= 5 && memcmp(response + len - 5, "0\r\n\r\n", 5) == 0;
+    }
+    return eof;
+}
+
+// ĳ  ð, 0̸  
+long cache_ttl_ms(int status) {
+    if (status == 200 || status == 203 || status == 301) return CACHE_TTL_MS;
+    if (status == 404 || status == 410) return NEG_CACHE_TTL_MS;
+    return 0;
+}
+
+// 鿣    ׸   
+int serve_stale(int client_socket, char* key) {
+    ResponseBuf* stale = check_cache(key, 1);
+    if (!stale) {
+        return 0;
+    }
+    send_all(client_socket, stale->data, stale->len);
+    buf_release(stale);
+    return 1;
+}
+
+// ĳø  ޸𸮿  (׷̵ )
+void save_cache_shm() {
+    char name[64];
+    snprintf(name, sizeof(name), SHM_CACHE_NAME, (int)geteuid());
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        perror("shm_open");
+        return;
+    }
+    if (ftruncate(fd, sizeof(shm_cache)) < 0) {
+        perror("ftruncate");
+        close(fd);
+        return;
+    }
+    shm_cache* shm = mmap(NULL, sizeof(shm_cache), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    LOCK(&cache_lock);
+    shm->count = 0;
+    for (int i = 0; i < cache_count; i++) {
+        if (cache[i].value->len > BUFFER_SIZE) continue;
+        strcpy(shm->entries[shm->count].key, cache[i].key);
+        shm->entries[shm->count].len = cache[i].value->len;
+        shm->entries[shm->count].expires_ms = cache[i].expires_ms;
+        memcpy(shm->entries[shm->count].data, cache[i].value->data, cache[i].value->len);
+        shm->count++;
+    }
+    UNLOCK(&cache_lock);
+    munmap(shm, sizeof(shm_cache));
+}
+
+//  μ  ĳø а  ޸ 
+void load_cache_shm() {
+    char name[64];
+    snprintf(name, sizeof(name), SHM_CACHE_NAME, (int)geteuid());
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_uid != geteuid() || (st.st_mode & 077) || st.st_size < (off_t)sizeof(shm_cache)) {
+        fprintf(stderr, "ignoring shared cache %s (not ours)\n", name);
+        close(fd);
+        return;
+    }
+    shm_cache* shm = mmap(NULL, sizeof(shm_cache), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    shm_unlink(name);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    for (int i = 0; i < shm->count && i < CACHE_SIZE; i++) {
+        update_cache(shm->entries[i].key, shm->entries[i].data, shm->entries[i].len, shm->entries[i].expires_ms);
+    }
+    printf("loaded %d cache entries\n", shm->count);
+    munmap(shm, sizeof(shm_cache));
+}
+
+// fd ϳ Unix  
+int send_fd(int sock, int fd) {
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+int recv_fd(int sock) {
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+    if (recvmsg(sock, &msg, 0) != 1) {
+        return -1;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        return -1;
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+// ׷̵  ּ, ͸  0700  ٸ ڰ    -1
+// (/tmp   ͸ ٸ ڰ ̸   θ  ʵ)
+int upgrade_socket_addr(struct sockaddr_un* addr) {
+    char dir[64];
+    snprintf(dir, sizeof(dir), UPGRADE_DIR, (int)geteuid());
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        perror("upgrade dir");
+        return -1;
+    }
+    struct stat st;
+    if (lstat(dir, &st) < 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077)) {
+        fprintf(stderr, "upgrade dir %s is not a private directory owned by uid %d, upgrades disabled\n", dir, (int)geteuid());
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s", dir, UPGRADE_SOCKET_NAME);
+    return 0;
+}
+
+// Unix  밡  uid  
+int peer_is_self(int sock) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 || cred.uid != geteuid()) {
+        fprintf(stderr, "upgrade peer rejected (uid %d)\n", len == sizeof(cred) ? (int)cred.uid : -1);
+        return 0;
+    }
+    return 1;
+}
+
+//  fd LISTENPORT listen  TCP 
+int is_our_listener(int fd) {
+    int type = 0;
+    int listening = 0;
+    socklen_t len = sizeof(type);
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0 || type != SOCK_STREAM) return 0;
+    len = sizeof(listening);
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || !listening) return 0;
+    if (getsockname(fd, (struct sockaddr*)&addr, &addr_len) < 0 || addr.sin_family != AF_INET) return 0;
+    return ntohs(addr.sin_port) == LISTENPORT;
+}
+
+//    μ   ,  -1
+int takeover_listen_socket() {
+    struct sockaddr_un addr;
+    if (upgrade_socket_addr(&addr) < 0) {
+        return -1;
+    }
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || !peer_is_self(sock)) {
+        close(sock);
+        return -1;
+    }
+    int fd = recv_fd(sock);
+    close(sock);
+    if (fd >= 0 && !is_our_listener(fd)) {
+        fprintf(stderr, "received fd is not a TCP listener on port %d, ignoring\n", LISTENPORT);
+        close(fd);
+        return -1;
+    }
+    if (fd >= 0) {
+        printf("took over listening socket from previous process\n");
+        if (SHM_CACHE) load_cache_shm();
+    }
+    return fd;
+}
+
+// ׷̵ û  :  μ ϸ ĳÿ   ѱ drain 
+void* upgrade_thread(void* arg) {
+    int unix_socket = (int)(long)arg;
+    while (1) {
+        int conn = accept(unix_socket, NULL, NULL);
+        if (conn < 0) {
+            perror("upgrade accept");
+            continue;
+        }
+        if (!peer_is_self(conn)) {
+            close(conn);
+            continue;
+        }
+        if (SHM_CACHE) save_cache_shm();
+        int sent = send_fd(conn, listen_socket);
+        close(conn);
+        if (sent == 0) {
+            //  μ θ ٽ εϹǷ ⼭ ݱ⸸
+            close(unix_socket);
+            __atomic_store_n(&draining, 1, __ATOMIC_RELEASE);
+            return NULL;
+        }
+        perror("send listening socket");
+    }
+    return NULL;
+}
+
+int start_upgrade_listener() {
+    struct sockaddr_un addr;
+    if (upgrade_socket_addr(&addr) < 0) {
+        return -1;
+    }
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("upgrade socket");
+        return -1;
+    }
+    unlink(addr.sun_path);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 1) < 0) {
+        perror("upgrade bind");
+        close(sock);
+        return -1;
+    }
+    pthread_t tid;
+    pthread_create(&tid, NULL, upgrade_thread, (void*)(long)sock);
+    return 0;
+}
+
+// ť ó  û   ٸ (ִ DRAIN_TIMEOUT_MS)
+void drain() {
+    long deadline = now_ms() + DRAIN_TIMEOUT_MS;
+    while (now_ms() < deadline) {
+        LOCK(&queue.mutex);
+        int remaining = queue.count + busy_workers;
+        UNLOCK(&queue.mutex);
+        if (remaining == 0) {
+            printf("drained, exiting\n");
+            return;
+        }
+        usleep(10000);
+    }
+    fprintf(stderr, "drain timeout, exiting with requests in flight\n");
+}
+
+// Ŀ ڽ  ,   
+void trace_submit(trace_ring* ring, const trace_record* rec) {
+    unsigned long head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+    ring->records[head & (TRACE_RING_SIZE - 1)] = *rec;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+//      TRACE_FILE 
+void trace_dump() {
+    unsigned long heads[TRACE_RINGS];
+    trace_file_header header = { TRACE_MAGIC, 0, trace_ticks_per_us };
+    for (int i = 0; i < TRACE_RINGS; i++) {
+        heads[i] = __atomic_load_n(&trace_rings[i].head, __ATOMIC_ACQUIRE);
+        header.count += heads[i] - trace_rings[i].tail;
+    }
+    FILE* f = fopen(TRACE_FILE, "wb");
+    if (!f) {
+        perror("trace file");
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, f);
+    unsigned long dropped = 0;
+    for (int i = 0; i < TRACE_RINGS; i++) {
+        trace_ring* ring = &trace_rings[i];
+        for (unsigned long n = ring->tail; n != heads[i]; n++) {
+            fwrite(&ring->records[n & (TRACE_RING_SIZE - 1)], sizeof(trace_record), 1, f);
+        }
+        __atomic_store_n(&ring->tail, heads[i], __ATOMIC_RELEASE);
+        dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    }
+    fclose(f);
+    printf("trace: %u records to %s (%lu dropped so far)\n", header.count, TRACE_FILE, dropped);
+}
+
+// SIGUSR1(Ʈ̽ ), SIGUSR2( 踦 stdout)   (ٸ     )
+void* signal_thread(void* arg) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    while (1) {
+        int sig;
+        if (sigwait(&set, &sig) != 0) {
+            continue;
+        }
+        if (sig == SIGUSR1 && TRACE) {
+            trace_dump();
+        } else if (sig == SIGUSR2) {
+            fflush(stdout);
+            write_lock_stats(STDOUT_FILENO, &queue_usage, 1);
+        }
+    }
+    return NULL;
+}
+
+// ø û  
+#define TRACE_MARK(mark) do { if (traced) rec.ts[mark] = trace_clock(); } while (0)
+
 void* handle_client(void* arg) {
+    int worker = (int)(long)arg;
+    unsigned long request_count = 0;
     while (1) {
-        int client_socket = dequeue();
+        int shed;
+        client_request req;
+        int client_socket = dequeue(&shed, &req);
+        if (req.pending) {
+            // accept 尡   ĳ Ʈ: ̹  Ƿ  ʰ  
+            send_all(client_socket, req.pending->data + req.pending_sent, req.pending->len - req.pending_sent);
+            buf_release(req.pending);
+            close(client_socket);
+            continue;
+        }
+        if (shed) {
+            reject_overload(client_socket);
+            continue;
+        }
+
+        trace_record rec;
+        int traced = TRACE && ++request_count % TRACE_SAMPLE_RATE == 0;
+        if (traced) {
+            memset(&rec, 0, sizeof(rec));
+            rec.ts[MARK_ACCEPT] = req.accept_tsc;
+            rec.worker = worker;
+        }
+        TRACE_MARK(MARK_DEQUEUE);
 
         char client_ip[16];
         struct sockaddr_in addr;
@@ -159,35 +1124,53 @@ void* handle_client(void* arg) {
         }
 
         char buffer[BUFFER_SIZE];
-        memset(buffer, 0, BUFFER_SIZE);
 
-        // û б
-        int bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
+        // û б (accept 尡 о  ״ )
+        int bytes_received = req.request_len;
+        if (bytes_received > 0) {
+            memcpy(buffer, req.request, bytes_received);
+        }
+        else {
+            bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
+        }
         if (bytes_received <= 0) {
             close(client_socket);
             continue;
         }
+        buffer[bytes_received] = '\0';
+        TRACE_MARK(MARK_RECV);
 
-        char cache_key[256];
-        sscanf(buffer, "GET %s HTTP/1.1", cache_key);
+        char cache_key[256] = ""; // GET ƴϸ  ΰ ĳ 
+        sscanf(buffer, "GET %255s HTTP/1.1", cache_key);
 
-        char cache_value[BUFFER_SIZE];
-        if (check_cache(cache_key, cache_value)) {
+        ResponseBuf* cached = cache_key[0] ? check_cache(cache_key, 0) : NULL;
+        TRACE_MARK(MARK_CACHE);
+        if (cached) {
             //hit
 
-            send(client_socket, cache_value, strlen(cache_value), 0);
+            rec.hit = 1;
+            send_all(client_socket, cached->data, cached->len);
+            buf_release(cached);
         }
         else {
             //miss 
 
-            int server_index = load_balance(client_ip);
+            char affinity[256];
+            affinity_key(buffer, client_ip, affinity, sizeof(affinity));
+            int server_index = load_balance(affinity, key_replicas(affinity));
+            if (server_index < 0) {
+                reject_overload(client_socket);
+                continue;
+            }
             server_info selected_server = web_servers[server_index];
+            long start_ms = now_ms();
 
             int server_socket;
             struct sockaddr_in server_addr;
             server_socket = socket(AF_INET, SOCK_STREAM, 0);
             if (server_socket == -1) {
                 perror("Socket creation failed for server");
+                backend_release(server_index, 0, 1);
                 close(client_socket);
                 continue;
             }
@@ -198,60 +1181,197 @@ void* handle_client(void* arg) {
 
             if (connect(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
                 perror("connect");
+                backend_release(server_index, now_ms() - start_ms, 0);
+                if (cache_key[0]) serve_stale(client_socket, cache_key);
                 close(client_socket);
                 close(server_socket);
                 continue;
             }
 
+            TRACE_MARK(MARK_CONNECT);
+
             send(server_socket, buffer, bytes_received, 0);
-            int server_response = recv(server_socket, buffer, sizeof(buffer), 0);
-            if (server_response > 0) {
-                send(client_socket, buffer, server_response, 0);
-                update_cache(cache_key, buffer); 
+            //  ų ۰   
+            int server_response = 0;
+            int n = 0;
+            buffer[0] = '\0';
+            while (server_response < (int)sizeof(buffer) - 1
+                && (n = recv(server_socket, buffer + server_response, sizeof(buffer) - 1 - server_response, 0)) > 0) {
+                server_response += n;
+                buffer[server_response] = '\0';
+                if (response_complete(buffer, server_response, 0)) {
+                    break;
+                }
+            }
+            TRACE_MARK(MARK_UPSTREAM);
+            backend_release(server_index, now_ms() - start_ms, server_response > 0);
+            int status = server_response > 0 ? response_status(buffer) : 0;
+
+            //  ų 5xx stale-if-error,  䵵    
+            int stale = (server_response <= 0 || status >= 500) && cache_key[0] && serve_stale(client_socket, cache_key);
+            if (!stale && server_response > 0) {
+                send_all(client_socket, buffer, server_response);
+                int complete = response_complete(buffer, server_response, n == 0);
+                long ttl = complete ? cache_ttl_ms(status) : 0;
+                if (cache_key[0] && ttl > 0) {
+                    update_cache(cache_key, buffer, server_response, now_ms() + ttl);
+                }
+                // ۺ ū   ĳ  ״ 
+                while (!complete && server_response == (int)sizeof(buffer) - 1 && (n = recv(server_socket, buffer, sizeof(buffer), 0)) > 0) {
+                    send_all(client_socket, buffer, n);
+                }
             }
             close(server_socket);
         }
+        TRACE_MARK(MARK_DONE);
+        if (traced) {
+            trace_submit(&trace_rings[worker], &rec);
+        }
         close(client_socket);
     }
     return NULL;
 }
 
+// accept 忡 û ̹   а, ĳ Ʈ ٷ  (ó 1)
+//  û request/request_len  Ŀ ٽ  
+// ۽ MSG_DONTWAIT accept 尡  ʰ, Ŭ̾Ʈ   ۾     Ŀ ѱ
+int serve_inline(int client_socket, char* request, int* request_len, uint64_t accept_tsc) {
+    static unsigned long request_count = 0; // accept 常 
+    *request_len = 0;
+    int n = recv(client_socket, request, BUFFER_SIZE - 1, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0; //   , Ŀ ٸ
+    }
+    if (n <= 0) {
+        close(client_socket);
+        return 1;
+    }
+    request[n] = '\0';
+    *request_len = n;
+
+    trace_record rec;
+    int traced = TRACE && ++request_count % TRACE_SAMPLE_RATE == 0;
+    if (traced) {
+        memset(&rec, 0, sizeof(rec));
+        rec.ts[MARK_ACCEPT] = accept_tsc;
+        rec.worker = NUM_WORKERS;
+        rec.hit = 1;
+    }
+    TRACE_MARK(MARK_RECV);
+
+    char cache_key[256] = "";
+    sscanf(request, "GET %255s HTTP/1.1", cache_key);
+    ResponseBuf* cached = cache_key[0] ? check_cache(cache_key, 0) : NULL;
+    if (!cached) {
+        return 0;
+    }
+    TRACE_MARK(MARK_CACHE);
+    int sent = send(client_socket, cached->data, cached->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        sent = 0;
+    }
+    //   ۾     Ŀ ٸ  ( ť Ѿ)
+    if (sent >= 0 && sent < cached->len && enqueue(client_socket, request, 0, cached, sent, accept_tsc) == 0) {
+        return 1;
+    }
+    buf_release(cached);
+    close(client_socket);
+    TRACE_MARK(MARK_DONE);
+    if (traced) {
+        trace_submit(&trace_rings[NUM_WORKERS], &rec);
+    }
+    return 1;
+}
+
 int main() {
     int server_socket;
     struct sockaddr_in server_addr, client_addr;
     socklen_t client_addr_len = sizeof(client_addr);
 
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        perror("Socket creation failed");
-        return -1;
-    }
+    build_ring();
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(LISTENPORT);
+    register_lock(&queue.mutex, "queue.mutex");
+    register_lock(&cache_lock, "cache_lock");
+    register_lock(&limit_lock, "limit_lock");
 
-    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("bind");
-        return -1;
+    // SIGUSR1, SIGUSR2 ñ׳ 常  (  忡 )
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    if (TRACE) {
+        trace_calibrate();
     }
+    pthread_t signal_tid;
+    pthread_create(&signal_tid, NULL, signal_thread, NULL);
 
-    listen(server_socket, MAX_CLIENTS);
+    //  μ    Ѱܹް,   
+    server_socket = takeover_listen_socket();
+    if (server_socket < 0) {
+        server_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (server_socket < 0) {
+            perror("Socket creation failed");
+            return -1;
+        }
 
-    pthread_t tids[5];
-    for (int i = 0; i < 5; i++) {
-        pthread_create(&tids[i], NULL, handle_client, NULL);
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_addr.s_addr = INADDR_ANY;
+        server_addr.sin_port = htons(LISTENPORT);
+
+        if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+            perror("bind");
+            return -1;
+        }
+
+        listen(server_socket, MAX_CLIENTS);
+        // û  Ḹ acceptǵ ؼ ζ ó  recv ٸ ʰ 
+        if (INLINE_HITS) {
+            int defer_secs = 1;
+            setsockopt(server_socket, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_secs, sizeof(defer_secs));
+        }
     }
+    //   ŷ (accept Ͽ ӵ )
+    fcntl(server_socket, F_SETFL, fcntl(server_socket, F_GETFL) | O_NONBLOCK);
+    listen_socket = server_socket;
+    start_upgrade_listener();
 
-    while (1) {
+    queue.last_empty_ms = now_ms();
+    pthread_t tids[NUM_WORKERS];
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        pthread_create(&tids[i], NULL, handle_client, (void*)(long)i);
+    }
+
+    // draining ÷׸ Ȯ  ֵ poll 
+    struct pollfd pfd = { server_socket, POLLIN, 0 };
+    while (!__atomic_load_n(&draining, __ATOMIC_ACQUIRE)) {
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
         int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_addr_len);
         if (client_socket < 0) {
-            perror("accept");
+            // ׷̵ ߿  μ     
+            if (errno != EAGAIN) perror("accept");
+            continue;
+        }
+        // ѵ  Ŭ̾Ʈ Ŀ  ʰ ٷ 429
+        if (RATE_LIMIT && !rate_allow(&client_addr)) {
+            reject_rate_limited(client_socket);
+            continue;
+        }
+        char request[BUFFER_SIZE];
+        int request_len = 0;
+        uint64_t accept_tsc = TRACE ? trace_clock() : 0;
+        if (INLINE_HITS && serve_inline(client_socket, request, &request_len, accept_tsc)) {
             continue;
         }
-        enqueue(client_socket);
+        // ť   accept   ʰ ٷ 
+        if (enqueue(client_socket, request, request_len, NULL, 0, accept_tsc) < 0) {
+            reject_overload(client_socket);
+        }
     }
 
     close(server_socket);
+    drain();
     return 0;
 }
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,20 +8,59 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
-
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <signal.h>
 
 #define LISTENPORT 5294
 #define PORTNUM3 5298
 #define PORTNUM1 5297
 #define PORTNUM2 5296
-#define MAX_CLIENTS 100
+#define MAX_CLIENTS 4096 // listen 백로그, 연결이 몰려도 리액터가 따라잡을 때까지 버팀
 #define NUM_SERVERS 3
+#define PIPE_SIZE 65536 // 방향마다 쓰는 파이프 용량
+#define NUM_REACTORS 4 // epoll 스레드 수, 각자 리스닝 소켓에서 accept하고 그 연결을 끝까지 처리
+#define MAX_EVENTS 256
+#define PIPE_POOL_SIZE 64 // 리액터마다 쉬는 파이프를 이만큼 보관, 넘으면 닫음
 
 typedef struct {
     char ip[16];
     int port;
 } server_info;
 
+// 릴레이에 쓰는 파이프, 데이터가 지나가는 동안만 연결에 붙음
+typedef struct pipe_buf {
+    int fds[2];
+    int pending; // 파이프에 남아 있는 바이트
+    struct pipe_buf* next; // 풀 안에서 다음 파이프
+} pipe_buf;
+
+// 한 방향 릴레이 상태 (소켓 -> 파이프 -> 소켓, 데이터는 커널 안에서만 이동)
+typedef struct {
+    pipe_buf* pipe; // 보낼 데이터가 없으면 NULL
+    unsigned char eof; // from 쪽에서 EOF 받음
+    unsigned char done; // 남은 데이터까지 보내고 to 쪽에 SHUT_WR 완료
+} relay_dir;
+
+// 연결 하나의 상태, 유휴 연결은 이 구조체(48바이트)와 소켓 두 개만 차지
+typedef struct {
+    int client_socket;
+    int server_socket;
+    relay_dir up; // 클라 -> 서버
+    relay_dir down; // 서버 -> 클라
+    unsigned char connecting; // 서버 connect 진행 중
+    unsigned char closed; // 닫았지만 이번 epoll_wait 결과에 남아 있을 수 있음
+} conn;
+
+// epoll 스레드 하나의 상태 (다른 스레드와 공유하지 않음)
+typedef struct {
+    int epoll_fd;
+    pipe_buf* free_pipes;
+    int free_count;
+} reactor;
+
 server_info web_servers[] = {
     {"10.198.138.212", PORTNUM1},
     {"10.198.138.212", PORTNUM2},
@@ -60,10 +100,115 @@ int load_balance(char* client_ip) {
     return murmur_hash(client_ip);
 }
 
-void* handle_client(void* arg) {
-    int client_socket = *(int*)arg; 
-    free(arg); 
+// 풀에서 파이프를 꺼냄, 비었으면 새로 만듦
+pipe_buf* pipe_get(reactor* r) {
+    pipe_buf* p = r->free_pipes;
+    if (p) {
+        r->free_pipes = p->next;
+        r->free_count--;
+        return p;
+    }
+    p = malloc(sizeof(pipe_buf));
+    if (!p) {
+        return NULL;
+    }
+    if (pipe2(p->fds, O_NONBLOCK) < 0) {
+        perror("pipe failed");
+        free(p);
+        return NULL;
+    }
+    fcntl(p->fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+    p->pending = 0;
+    return p;
+}
+
+// 빈 파이프를 풀에 돌려줌 (풀이 가득 차면 닫음)
+void pipe_put(reactor* r, pipe_buf* p) {
+    if (p->pending > 0 || r->free_count >= PIPE_POOL_SIZE) {
+        close(p->fds[0]);
+        close(p->fds[1]);
+        free(p);
+        return;
+    }
+    p->next = r->free_pipes;
+    r->free_pipes = p;
+    r->free_count++;
+}
+
+// 한 방향으로 막힐 때까지 splice, 오류면 -1
+// edge-triggered라 읽기는 from이 EAGAIN/EOF일 때만, 쓰기는 to가 EAGAIN이거나 보낼 게 없을 때만 멈출 수 있음
+// (파이프가 가득 차서 읽기를 건너뛴 뒤 쓰기로 자리가 나면 다시 읽어야 함, 아니면 새 이벤트가 오지 않아 멈춤)
+// 파이프는 읽을 때 풀에서 가져오고 다 보내면 돌려줌
+int relay_step(reactor* r, relay_dir* dir, int from, int to) {
+    int progress = 1;
+    while (progress && !dir->done) {
+        progress = 0;
+        if (!dir->eof && (!dir->pipe || dir->pipe->pending < PIPE_SIZE)) {
+            if (!dir->pipe && !(dir->pipe = pipe_get(r))) {
+                return -1;
+            }
+            ssize_t n = splice(from, NULL, dir->pipe->fds[1], NULL, PIPE_SIZE - dir->pipe->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) dir->pipe->pending += n;
+            else if (n == 0) dir->eof = 1;
+            else if (errno != EAGAIN) return -1;
+            progress = n >= 0;
+        }
+        while (dir->pipe && dir->pipe->pending > 0) {
+            ssize_t n = splice(dir->pipe->fds[0], NULL, to, NULL, dir->pipe->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                dir->pipe->pending -= n;
+                progress = 1; // 파이프에 자리가 났으니 from을 다시 읽음
+            }
+            else if (n < 0 && errno == EAGAIN) break;
+            else return -1;
+        }
+        if (dir->pipe && dir->pipe->pending == 0) {
+            pipe_put(r, dir->pipe);
+            dir->pipe = NULL;
+        }
+        // half-close: 받은 쪽이 끝나면 반대쪽에 쓰기 종료만 전달
+        if (dir->eof && !dir->pipe) {
+            shutdown(to, SHUT_WR);
+            dir->done = 1;
+        }
+    }
+    return 0;
+}
+
+void conn_close(reactor* r, conn* c) {
+    if (c->up.pipe) pipe_put(r, c->up.pipe);
+    if (c->down.pipe) pipe_put(r, c->down.pipe);
+    close(c->client_socket);
+    close(c->server_socket);
+    c->closed = 1;
+}
+
+// 연결 소켓 중 하나에 이벤트: 두 방향 모두 진행, 끝났거나 오류면 -1
+int conn_event(reactor* r, conn* c) {
+    if (c->connecting) {
+        // 진행 중이면 SO_ERROR는 0이고 getpeername은 ENOTCONN
+        int err = 0;
+        socklen_t len = sizeof(err);
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        if (getsockopt(c->server_socket, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            fprintf(stderr, "Server connect failed: %s\n", strerror(err));
+            return -1;
+        }
+        if (getpeername(c->server_socket, (struct sockaddr*)&addr, &addr_len) < 0) {
+            return 0;
+        }
+        c->connecting = 0;
+    }
+    if (relay_step(r, &c->up, c->client_socket, c->server_socket) < 0
+        || relay_step(r, &c->down, c->server_socket, c->client_socket) < 0) {
+        return -1;
+    }
+    return c->up.done && c->down.done ? -1 : 0;
+}
 
+// 새 클라이언트: 해시로 서버를 고르고 논블로킹 connect, 두 소켓을 이 리액터의 epoll에 등록
+void conn_open(reactor* r, int client_socket) {
     // 클라이언트 IP
     struct sockaddr_in client_addr;
     socklen_t addr_len = sizeof(client_addr);
@@ -76,61 +221,103 @@ void* handle_client(void* arg) {
     server_info selected_server = web_servers[server_index];
 
     // 서버와의 연결
-    int server_socket;
-    struct sockaddr_in server_addr;
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    int server_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (server_socket < 0) {
         perror("Socket creation failed for server");
         close(client_socket);
-        return NULL;
+        return;
     }
 
+    struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(selected_server.port);
     inet_pton(AF_INET, selected_server.ip, &server_addr.sin_addr);
 
-    if (connect(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+    int connected = connect(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr));
+    if (connected < 0 && errno != EINPROGRESS) {
         perror("Server connect failed");
         close(client_socket);
         close(server_socket);
-        return NULL;
+        return;
     }
 
-    char buffer[1024];
-    int bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
-    if (bytes_received > 0) {
-        send(server_socket, buffer, bytes_received, 0);
-    }
-    else if (bytes_received < 0) {
-        perror("recv from client failed");
+    conn* c = calloc(1, sizeof(conn));
+    if (!c) {
+        perror("Memory allocation failed");
         close(client_socket);
         close(server_socket);
-        return NULL;
+        return;
     }
+    c->client_socket = client_socket;
+    c->server_socket = server_socket;
+    c->connecting = connected < 0;
 
-    // 서버 -> 클라
-    while ((bytes_received = recv(server_socket, buffer, sizeof(buffer), 0)) > 0) {
-        send(client_socket, buffer, bytes_received, 0);
+    // 두 소켓 모두 같은 conn을 가리킴, 어느 쪽 이벤트든 두 방향을 다 진행
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = c };
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) < 0
+        || epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, server_socket, &ev) < 0) {
+        perror("epoll add failed");
+        close(client_socket);
+        close(server_socket);
+        free(c);
     }
+}
 
-    if (bytes_received < 0) {
-        perror("recv from server failed");
+// 리액터 스레드: 리스닝 소켓(EPOLLEXCLUSIVE로 한 스레드만 깨어남)과 자기 연결을 감시
+// 연결은 accept한 리액터가 끝까지 처리하므로 연결 상태에 락이 필요 없음
+void* reactor_thread(void* arg) {
+    int listen_socket = (int)(intptr_t)arg;
+    reactor r = { .epoll_fd = epoll_create1(0), .free_pipes = NULL, .free_count = 0 };
+    if (r.epoll_fd < 0) {
+        perror("epoll create failed");
+        return NULL;
     }
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+    epoll_ctl(r.epoll_fd, EPOLL_CTL_ADD, listen_socket, &ev);
 
-    close(client_socket);
-    close(server_socket);
-
+    struct epoll_event events[MAX_EVENTS];
+    conn* closed[MAX_EVENTS];
+    while (1) {
+        int n = epoll_wait(r.epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll wait failed");
+            break;
+        }
+        int closed_count = 0;
+        for (int i = 0; i < n; i++) {
+            conn* c = events[i].data.ptr;
+            if (!c) {
+                int client_socket;
+                while ((client_socket = accept4(listen_socket, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+                    conn_open(&r, client_socket);
+                }
+                if (errno != EAGAIN) perror("Accept failed");
+                continue;
+            }
+            // 같은 연결의 두 소켓 이벤트가 함께 올 수 있어서 해제는 이번 결과를 다 처리한 뒤
+            if (c->closed) {
+                continue;
+            }
+            if (conn_event(&r, c) < 0) {
+                conn_close(&r, c);
+                closed[closed_count++] = c;
+            }
+        }
+        for (int i = 0; i < closed_count; i++) {
+            free(closed[i]);
+        }
+    }
     return NULL;
 }
 
 int main() {
     int server_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
+    struct sockaddr_in server_addr;
 
     // 서버 소켓 생성
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    server_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (server_socket < 0) {
         perror("Socket creation failed");
         return -1;
@@ -155,26 +342,16 @@ int main() {
 
     printf("Server listening on port %d\n", LISTENPORT);
 
-    // 스레드 생성
-    while (1) {
-        int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_addr_len);
-        if (client_socket < 0) {
-            perror("Accept failed");
-            continue;
-        }
+    // 끊긴 소켓에 splice 할 때 프로세스가 죽지 않도록
+    signal(SIGPIPE, SIG_IGN);
 
-        int* client_socket_ptr = malloc(sizeof(int));
-        if (!client_socket_ptr) {
-            perror("Memory allocation failed");
-            close(client_socket);
-            continue;
-        }
-
-        *client_socket_ptr = client_socket;
-
-        pthread_t thread_id;
-        pthread_create(&thread_id, NULL, handle_client, client_socket_ptr);
-        pthread_detach(thread_id); 
+    // 리액터 스레드 생성 (연결마다 스레드를 만들지 않음)
+    pthread_t reactors[NUM_REACTORS];
+    for (int i = 0; i < NUM_REACTORS; i++) {
+        pthread_create(&reactors[i], NULL, reactor_thread, (void*)(intptr_t)server_socket);
+    }
+    for (int i = 0; i < NUM_REACTORS; i++) {
+        pthread_join(reactors[i], NULL);
     }
 
     close(server_socket);
@@ -0,0 +1,154 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// hash_noqueue.c 유휴 연결 벤치마크
+// 사용법: idle_bench 프록시pid 연결수 [샘플수] [프록시주소] [포트]
+// 연결을 연결수만큼 열어 두고 프록시 RSS 증가분(연결당 바이트)을 잰 뒤,
+// 무작위 연결에 짧은 요청을 보내 첫 응답 바이트까지 걸린 시간(깨어나는 지연)을 샘플수만큼 잼
+// 백엔드는 연결을 유지한 채 요청마다 응답하는 서버여야 함 (에코 서버면 PAYLOAD가 그대로 돌아옴)
+// 프록시는 연결마다 소켓 2개를 쓰므로 ulimit -n 이 연결수 * 2보다 커야 함 (이 프로그램도 연결수만큼 필요)
+
+#define DEFAULT_SAMPLES 2000
+#define DEFAULT_PORT 5294
+#define SOURCE_ADDRS 200 // 루프백 대상이면 127.0.0.2부터 이만큼 출발 주소를 돌려 씀 (포트 고갈 방지, 해시 분산)
+#define DRAIN_MS 20 // 응답 나머지를 버리며 기다리는 시간 (지연에는 포함하지 않음)
+#define PAYLOAD "GET / HTTP/1.1\r\nHost: idle-bench\r\n\r\n"
+
+long read_rss_kb(int pid) {
+    char path[64];
+    char line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror("proc status");
+        return -1;
+    }
+    long rss = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmRSS:", 6) == 0) {
+            rss = atol(line + 6);
+            break;
+        }
+    }
+    fclose(f);
+    return rss;
+}
+
+double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// 요청을 보내고 첫 바이트까지 걸린 시간 (us), 연결이 끊겼으면 -1
+double wake_one(int fd) {
+    char buf[4096];
+    double start = now_us();
+    if (send(fd, PAYLOAD, sizeof(PAYLOAD) - 1, MSG_NOSIGNAL) != sizeof(PAYLOAD) - 1) {
+        return -1;
+    }
+    if (recv(fd, buf, sizeof(buf), 0) <= 0) {
+        return -1;
+    }
+    double elapsed = now_us() - start;
+    // 다음 샘플에 섞이지 않도록 응답 나머지를 비움
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    while (poll(&pfd, 1, DRAIN_MS) > 0) {
+        if (recv(fd, buf, sizeof(buf), 0) <= 0) break;
+    }
+    return elapsed;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s proxy_pid connections [samples] [address] [port]\n", argv[0]);
+        return 1;
+    }
+    int pid = atoi(argv[1]);
+    int count = atoi(argv[2]);
+    int samples = argc > 3 ? atoi(argv[3]) : DEFAULT_SAMPLES;
+    const char* address = argc > 4 ? argv[4] : "127.0.0.1";
+    int port = argc > 5 ? atoi(argv[5]) : DEFAULT_PORT;
+
+    struct sockaddr_in proxy_addr;
+    memset(&proxy_addr, 0, sizeof(proxy_addr));
+    proxy_addr.sin_family = AF_INET;
+    proxy_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &proxy_addr.sin_addr) != 1) {
+        fprintf(stderr, "bad address %s\n", address);
+        return 1;
+    }
+    int loopback = (ntohl(proxy_addr.sin_addr.s_addr) >> 24) == 127;
+
+    int* fds = malloc(sizeof(int) * count);
+    long rss_before = read_rss_kb(pid);
+    int opened = 0;
+    for (; opened < count; opened++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("socket");
+            break;
+        }
+        if (loopback) {
+            struct sockaddr_in source;
+            memset(&source, 0, sizeof(source));
+            source.sin_family = AF_INET;
+            source.sin_addr.s_addr = htonl(0x7f000002 + opened % SOURCE_ADDRS);
+            bind(fd, (struct sockaddr*)&source, sizeof(source));
+        }
+        if (connect(fd, (struct sockaddr*)&proxy_addr, sizeof(proxy_addr)) < 0) {
+            perror("connect");
+            close(fd);
+            break;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fds[opened] = fd;
+    }
+    if (opened == 0) {
+        return 1;
+    }
+    sleep(2); // 프록시가 남은 accept와 백엔드 connect를 끝낼 시간
+    long rss_after = read_rss_kb(pid);
+    printf("%d idle connections: proxy rss %ld KB -> %ld KB, %.0f bytes per connection\n",
+        opened, rss_before, rss_after, (rss_after - rss_before) * 1024.0 / opened);
+
+    double* latency = malloc(sizeof(double) * samples);
+    int measured = 0;
+    int failed = 0;
+    srand(1);
+    for (int i = 0; i < samples; i++) {
+        double us = wake_one(fds[rand() % opened]);
+        if (us < 0) failed++;
+        else latency[measured++] = us;
+    }
+    if (measured > 0) {
+        qsort(latency, measured, sizeof(double), compare_double);
+        printf("wakeup latency n=%d p50=%.1fus p99=%.1fus max=%.1fus (%d failed)\n", measured,
+            latency[measured / 2], latency[(int)(measured * 0.99)], latency[measured - 1], failed);
+    }
+    printf("proxy rss after wakeups %ld KB\n", read_rss_kb(pid));
+
+    for (int i = 0; i < opened; i++) {
+        close(fds[i]);
+    }
+    free(latency);
+    free(fds);
+    return 0;
+}
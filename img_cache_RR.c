@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,7 +8,18 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
+#include <sched.h>
+#ifdef USE_TLS
+#include <openssl/ssl.h> // -DUSE_TLS -lssl -lcrypto  
+#include <openssl/err.h>
+#include <signal.h>
+#endif
 
 #define LISTENPORT 5294
 #define PORTNUM3 5298
@@ -17,6 +29,33 @@
 #define NUM_SERVERS 3
 #define QUEUE_SIZE 10 // Define the size of the queue
 #define CACHE_TIMEOUT 30 // ĳ  ð ()
+#define IMG_STORE_DIR "img_store" // ū ̹  ϴ ͸
+#define SPOOL_THRESHOLD 1024 // ̺ ū ̹  Ϸ 
+#define HEAD_SIZE 4096 //   Ľ̿  ũ
+
+// HTTP/1.1  :    accept  epoll ð ΰ  û  ٽ ť 
+#define KEEPALIVE_TIMEOUT_MS 5000 //  ð  û  
+#define MAX_KEEPALIVE_REQUESTS 100 //  ϳ ó ִ û 
+#define MAX_FDS 4096 // ̺ ū fd    ó
+#define MAX_EVENTS 64
+
+// ġ:   HTML <img src>, <link href>  켱  尡 ̸ ĳÿ ä
+#define PREFETCH 1
+#define PREFETCH_SCAN_BYTES 65536 // HTML պκп  ã
+#define PREFETCH_QUEUE_SIZE 64 //     
+#define PREFETCH_BYTES_PER_SEC (1024 * 1024) // ġ 鿣忡 ޾  뿪 ѵ
+#define PREFETCH_BURST_BYTES (256 * 1024)
+
+// TLS  (-DUSE_TLS ϸ LISTENPORT TLS )
+#define TLS_CERT_FILE "server.crt"
+#define TLS_KEY_FILE "server.key"
+#define TLS_SESSION_CACHE_SIZE 20480 //  ID 簳  ĳ ( Ŀ )
+#define TLS_HANDSHAKE_TIMEOUT_MS 5000
+
+// find_cache 
+#define CACHE_MISS 0
+#define CACHE_FRESH 1
+#define CACHE_STALE 2 //  ڰ ־ Ǻ û  
 
 typedef struct {
     char ip[16];
@@ -38,12 +77,58 @@ typedef struct {
 typedef struct {
     char url[256];
     char response[1024];
+    int response_len;
+    int store_fd; //  ҿ   fd, ޸ ̸ -1
+    off_t body_offset; //   ġ (  Ǵ response )
+    off_t body_len; //    
+    char content_type[64];
+    char etag[64];
+    int etag_generated; //   ETag     (   )
+    char last_modified[64];
     time_t timestamp;
+    int prefetched; // ġ ä  Ŭ̾Ʈ û 
 } cache_entry;
 
+//    (fd ε)
+typedef struct {
+    long idle_deadline_ms; // epoll  û ٸ ̸ 0 ƴ
+    int requests;
+} conn_state;
+
+//   Ŭ̾Ʈ 鼭 Connection  ٲٰ   
+typedef struct {
+    int client_socket;
+    int keep_alive;
+    int header_done;
+    char head[HEAD_SIZE];
+    int head_len;
+    long long total_len; //  ü ̸ ˸ (ĳ ) Content-Length ä  , 𸣸 -1
+    long long body_left; //   Ʈ,   θ    -1
+} response_writer;
+
+// relay_response ġ ä 
+typedef struct {
+    int collect_html; // HTML ̸  պκ html 
+    char* html; // NUL , ȣ ʿ free
+    int html_len;
+    long long received; //   Ʈ  (뿪 )
+} prefetch_info;
+
+typedef struct {
+    char url[256];
+    char host[128]; //  û Host
+} prefetch_job;
+
+typedef struct {
+    prefetch_job jobs[PREFETCH_QUEUE_SIZE];
+    int front, rear, count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_non_empty;
+} prefetch_queue;
+
 server_info web_servers[] = {
     {"10.198.138.212", PORTNUM1}, // Example server IP, replace accordingly
-    {"10.198.138.212", PORTNUM2}  // Example server IP, replace accordingly
+    {"10.198.138.212", PORTNUM2},  // Example server IP, replace accordingly
     {"10.198.138.212", PORTNUM3}
 };
 
@@ -58,10 +143,32 @@ request_queue queue = {
 
 cache_entry cache[100]; // ĳ 迭, ִ 100 ׸ 
 int cache_count = 0; // ĳ ׸ 
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+long long revalidate_saved_bytes = 0; // 304      ũ 
+
+long prefetch_stored = 0; // ġ ĳÿ   (cache_lock ȣ)
+long prefetch_used = 0; //  Ŭ̾Ʈ û ,  
+
+prefetch_queue prefetch_jobs = {
+    .front = 0,
+    .rear = 0,
+    .count = 0,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond_non_empty = PTHREAD_COND_INITIALIZER
+};
 
 int current_server_index = 0;
 pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
+conn_state conns[MAX_FDS];
+int epoll_fd = -1;
+pthread_mutex_t park_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef USE_TLS
+SSL_CTX* tls_ctx; //  ĳÿ Ƽ Ű  Ŀ 
+SSL* tls_sessions[MAX_FDS]; // Ŭ̾Ʈ fd TLS , ڵũ ̸ NULL
+#endif
+
 //  κ   
 int load_balance() {
     pthread_mutex_lock(&lock);
@@ -98,96 +205,1039 @@ int dequeue() {
     return client_socket;
 }
 
-// ĳÿ û URL شϴ  ã
-char* find_cache(const char* url) {
+// ĳÿ û URL شϴ  ã (entry ,   fd dupؼ ѱ)
+int find_cache(const char* url, cache_entry* entry) {
+    int state = CACHE_MISS;
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < cache_count; i++) {
+        if (strcmp(cache[i].url, url) != 0) {
+            continue;
+        }
+        // ĳõ  ȿ Ȯ,  ڰ    
+        if ((time(NULL) - cache[i].timestamp) < CACHE_TIMEOUT) {
+            state = CACHE_FRESH;
+        }
+        else if (!cache[i].etag_generated || cache[i].last_modified[0]) {
+            state = CACHE_STALE;
+        }
+        else {
+            break;
+        }
+        if (cache[i].prefetched) {
+            cache[i].prefetched = 0;
+            prefetch_used++;
+        }
+        *entry = cache[i];
+        if (cache[i].store_fd >= 0) {
+            entry->store_fd = dup(cache[i].store_fd);
+            if (entry->store_fd < 0) state = CACHE_MISS;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return state;
+}
+
+//   ׸ ִ Ȯ (ġ,   )
+int cache_has(const char* url) {
+    int found = 0;
+    pthread_mutex_lock(&cache_lock);
     for (int i = 0; i < cache_count; i++) {
-        // ĳõ  ȿ Ȯ
-        if (strcmp(cache[i].url, url) == 0 && (time(NULL) - cache[i].timestamp) < CACHE_TIMEOUT) {
-            return cache[i].response;
+        if (strcmp(cache[i].url, url) == 0) {
+            found = (time(NULL) - cache[i].timestamp) < CACHE_TIMEOUT;
+            break;
         }
     }
-    return NULL; // ĳÿ ã   NULL ȯ
+    pthread_mutex_unlock(&cache_lock);
+    return found;
 }
 
-// ĳÿ  
-void save_cache(const char* url, const char* response) {
-    if (cache_count < 100) {
-        strncpy(cache[cache_count].url, url, sizeof(cache[cache_count].url));
-        strncpy(cache[cache_count].response, response, sizeof(cache[cache_count].response));
-        cache[cache_count].timestamp = time(NULL);
+// 304   ĳ ׸ ȿ ð  
+void refresh_cache(const cache_entry* entry) {
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < cache_count; i++) {
+        if (strcmp(cache[i].url, entry->url) == 0) {
+            cache[i].timestamp = time(NULL);
+            strcpy(cache[i].etag, entry->etag);
+            strcpy(cache[i].last_modified, entry->last_modified);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// ĳÿ   ( URL  ü)
+void save_cache(const cache_entry* entry) {
+    int stale_fd = -1;
+    int stored = 0;
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < cache_count; i++) {
+        if (strcmp(cache[i].url, entry->url) == 0) {
+            stale_fd = cache[i].store_fd;
+            cache[i] = *entry;
+            stored = 1;
+            break;
+        }
+    }
+    if (!stored && cache_count < 100) {
+        cache[cache_count] = *entry;
         cache_count++;
+        stored = 1;
+    }
+    if (stored && entry->prefetched) {
+        prefetch_stored++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    //    dup fd Ƿ ٷ ݾƵ 
+    if (stale_fd >= 0) {
+        close(stale_fd);
+    }
+    if (!stored && entry->store_fd >= 0) {
+        close(entry->store_fd);
+    }
+}
+
+//   ã (ҹ ), ã 1 ȯ
+int find_header(const char* head, const char* name, char* value, int value_size) {
+    int name_len = strlen(name);
+    const char* line = strstr(head, "\r\n");
+    while (line && strncmp(line, "\r\n\r\n", 4) != 0) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char* v = line + name_len + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            int len = strcspn(v, "\r\n");
+            if (len >= value_size) len = value_size - 1;
+            memcpy(value, v, len);
+            value[len] = '\0';
+            return 1;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return 0;
+}
+
+// Range: bytes=- ؼ (  )
+// ȯ: 0  (ü ), 1 ȿ , -1    
+int parse_range(const char* request, off_t size, off_t* start, off_t* end) {
+    char range[128];
+    if (!find_header(request, "Range", range, sizeof(range)) || strncmp(range, "bytes=", 6) != 0 || strchr(range, ',')) {
+        return 0;
+    }
+    char* p = range + 6;
+    char* q;
+    if (*p == '-') {
+        //  N Ʈ
+        long long suffix = strtoll(p + 1, &q, 10);
+        if (q == p + 1 || suffix <= 0 || size == 0) return -1;
+        *start = suffix < size ? size - suffix : 0;
+        *end = size - 1;
+        return 1;
+    }
+    long long first = strtoll(p, &q, 10);
+    if (q == p || *q != '-') return 0;
+    p = q + 1;
+    long long last = strtoll(p, &q, 10);
+    if (q == p || last >= size) last = size - 1;
+    if (first >= size || first > last) return -1;
+    *start = first;
+    *end = last;
+    return 1;
+}
+
+// HTTP ¥ ؼ (RFC 1123 ĸ )
+time_t parse_http_date(const char* date) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (!strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm)) {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+// Ŭ̾Ʈ Ǻ û ĳ ׸ ġϸ 1 ȯ
+int client_not_modified(const char* request, const cache_entry* entry) {
+    char value[128];
+    if (find_header(request, "If-None-Match", value, sizeof(value))) {
+        return strcmp(value, "*") == 0 || strstr(value, entry->etag) != NULL;
+    }
+    if (entry->last_modified[0] && find_header(request, "If-Modified-Since", value, sizeof(value))) {
+        time_t since = parse_http_date(value);
+        time_t modified = parse_http_date(entry->last_modified);
+        return since != -1 && modified != -1 && modified <= since;
+    }
+    return 0;
+}
+
+//  ׸ ڸ  Ǻ û  (Ŭ̾Ʈ Ǻ  )
+int build_conditional_request(const char* request, const cache_entry* entry, char* out, int out_size) {
+    const char* line = strstr(request, "\r\n");
+    if (!line) {
+        return -1;
+    }
+    line += 2;
+    int len = line - request;
+    if (len >= out_size) {
+        return -1;
+    }
+    memcpy(out, request, len);
+    if (!entry->etag_generated) {
+        len += snprintf(out + len, out_size - len, "If-None-Match: %s\r\n", entry->etag);
+    }
+    if (entry->last_modified[0] && len < out_size) {
+        len += snprintf(out + len, out_size - len, "If-Modified-Since: %s\r\n", entry->last_modified);
     }
+    while (*line && len < out_size) {
+        const char* next = strstr(line, "\r\n");
+        int line_len = next ? next + 2 - line : (int)strlen(line);
+        if (strncasecmp(line, "If-None-Match:", 14) != 0 && strncasecmp(line, "If-Modified-Since:", 18) != 0) {
+            if (len + line_len >= out_size) {
+                return -1;
+            }
+            memcpy(out + len, line, line_len);
+            len += line_len;
+        }
+        line += line_len;
+    }
+    return len < out_size ? len : -1;
+}
+
+//   304 ĳ ׸ ϰ 1 ȯ (304 ƴϸ  Һ )
+int check_not_modified(int server_socket, cache_entry* entry) {
+    char head[HEAD_SIZE];
+    if (recv(server_socket, head, 12, MSG_PEEK | MSG_WAITALL) < 12 || strncmp(head + 8, " 304", 4) != 0) {
+        return 0;
+    }
+    int n = recv(server_socket, head, sizeof(head) - 1, 0);
+    head[n > 0 ? n : 0] = '\0';
+    char value[64];
+    if (find_header(head, "ETag", value, sizeof(value))) {
+        strcpy(entry->etag, value);
+        entry->etag_generated = 0;
+    }
+    if (find_header(head, "Last-Modified", value, sizeof(value))) {
+        strcpy(entry->last_modified, value);
+    }
+    refresh_cache(entry);
+
+    long long total = __atomic_add_fetch(&revalidate_saved_bytes, entry->body_len, __ATOMIC_RELAXED);
+    printf("Revalidated %s (304), upstream bytes saved: %lld\n", entry->url, total);
+    return 1;
+}
+
+#ifdef USE_TLS
+// ,  ĳ, Ŀ TLS 
+int tls_init() {
+    tls_ctx = SSL_CTX_new(TLS_server_method());
+    if (!tls_ctx) {
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+    SSL_CTX_set_min_proto_version(tls_ctx, TLS1_2_VERSION);
+    if (SSL_CTX_use_certificate_chain_file(tls_ctx, TLS_CERT_FILE) <= 0
+        || SSL_CTX_use_PrivateKey_file(tls_ctx, TLS_KEY_FILE, SSL_FILETYPE_PEM) <= 0) {
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+    // 簳:  ID  ĳ,  Ƽ SSL_CTX Ƽ Ű (⺻ Ȱȭ)
+    SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(tls_ctx, TLS_SESSION_CACHE_SIZE);
+    SSL_CTX_set_session_id_context(tls_ctx, (const unsigned char*)"img_cache_RR", 12);
+    // ڵũ  ȣȭ Ŀη Ѱ sendfile   (Ŀο tls  ְ AES-GCM )
+    SSL_CTX_set_options(tls_ctx, SSL_OP_ENABLE_KTLS);
+    SSL_CTX_set_ciphersuites(tls_ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256");
+    SSL_CTX_set_cipher_list(tls_ctx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+    return 0;
+}
+#endif
+
+// Ŭ̾Ʈ  غ: TLS  ڵũ   ڵũ (ϸ -1)
+int conn_start(int sock) {
+#ifdef USE_TLS
+    if (sock >= MAX_FDS) {
+        return -1;
+    }
+    if (tls_sessions[sock]) {
+        return 0;
+    }
+    struct timeval timeout = { TLS_HANDSHAKE_TIMEOUT_MS / 1000, (TLS_HANDSHAKE_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    SSL* ssl = SSL_new(tls_ctx);
+    if (!ssl || !SSL_set_fd(ssl, sock) || SSL_accept(ssl) <= 0) {
+        if (ssl) SSL_free(ssl);
+        return -1;
+    }
+    tls_sessions[sock] = ssl;
+#endif
+    return 0;
+}
+
+int conn_recv(int sock, void* buf, int len) {
+#ifdef USE_TLS
+    return SSL_read(tls_sessions[sock], buf, len);
+#else
+    return recv(sock, buf, len, 0);
+#endif
+}
+
+int conn_send(int sock, const void* data, int len, int flags) {
+#ifdef USE_TLS
+    // SSL_write ⺻  ų 
+    return SSL_write(tls_sessions[sock], data, len) == len ? len : -1;
+#else
+    return send(sock, data, len, flags);
+#endif
+}
+
+// TLS ǿ   Ͱ Ҵ (epollδ   )
+int conn_pending(int sock) {
+#ifdef USE_TLS
+    return SSL_pending(tls_sessions[sock]);
+#else
+    return 0;
+#endif
+}
+
+void conn_close(int sock) {
+#ifdef USE_TLS
+    if (sock < MAX_FDS && tls_sessions[sock]) {
+        SSL_shutdown(tls_sessions[sock]);
+        SSL_free(tls_sessions[sock]);
+        tls_sessions[sock] = NULL;
+    }
+#endif
+    close(sock);
+}
+
+//    sendfile  ( ĳÿ ٷ )
+// TLS kTLS   SSL_sendfile, ƴϸ о ȣȭ
+int send_file_range(int sock, int fd, off_t offset, off_t len) {
+#ifdef USE_TLS
+    SSL* ssl = tls_sessions[sock];
+    if (BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+        while (len > 0) {
+            ossl_ssize_t n = SSL_sendfile(ssl, fd, offset, len, 0);
+            if (n <= 0) {
+                return -1;
+            }
+            offset += n;
+            len -= n;
+        }
+        return 0;
+    }
+    char buffer[16384];
+    while (len > 0) {
+        ssize_t n = pread(fd, buffer, len < (off_t)sizeof(buffer) ? len : (off_t)sizeof(buffer), offset);
+        if (n <= 0 || SSL_write(ssl, buffer, n) != n) {
+            return -1;
+        }
+        offset += n;
+        len -= n;
+    }
+    return 0;
+#else
+    while (len > 0) {
+        ssize_t n = sendfile(sock, fd, &offset, len);
+        if (n <= 0) {
+            return -1;
+        }
+        len -= n;
+    }
+    return 0;
+#endif
+}
+
+//    (Ͻð   )
+int is_hop_header(const char* line) {
+    return strncasecmp(line, "Connection:", 11) == 0 || strncasecmp(line, "Keep-Alive:", 11) == 0
+        || strncasecmp(line, "Proxy-Connection:", 17) == 0;
+}
+
+//  (  ,    )     , ġ -1
+int copy_headers(const char* head, int header_len, char* out, int out_size) {
+    int len = 0;
+    const char* line = head;
+    const char* end = head + header_len - 2;
+    while (line < end) {
+        const char* next = strstr(line, "\r\n");
+        int line_len = next ? next + 2 - line : end - line;
+        if (line == head || !is_hop_header(line)) {
+            if (len + line_len >= out_size) return -1;
+            memcpy(out + len, line, line_len);
+            len += line_len;
+        }
+        line += line_len;
+    }
+    return len;
+}
+
+//   û Connection: close ٲ (      ֵ)
+int upstream_request(const char* request, int request_len, char* out, int out_size) {
+    const char* end = strstr(request, "\r\n\r\n");
+    if (!end) {
+        return -1;
+    }
+    int header_len = end - request + 4;
+    int len = copy_headers(request, header_len, out, out_size);
+    if (len < 0 || len + 21 + request_len - header_len >= out_size) {
+        return -1;
+    }
+    len += sprintf(out + len, "Connection: close\r\n\r\n");
+    memcpy(out + len, request + header_len, request_len - header_len);
+    return len + request_len - header_len;
+}
+
+// Ŭ̾Ʈ   ϴ (HTTP/1.1 ⺻ , HTTP/1.0 keep-alive )
+int wants_keep_alive(const char* request) {
+    char value[64] = "";
+    int has_connection = find_header(request, "Connection", value, sizeof(value));
+    const char* line_end = strstr(request, "\r\n");
+    int http11 = line_end && line_end - request >= 8 && strncmp(line_end - 8, "HTTP/1.1", 8) == 0;
+    if (has_connection && strcasestr(value, "close")) return 0;
+    return http11 || (has_connection && strcasestr(value, "keep-alive"));
+}
+
+// ̹ read û ϳ Ȯ  Դ ( , Content-Lengthŭ ,   Ʈ )
+// ƴϸ Ͽ    û ؼϰ ǹǷ    (û ӱ۸ )
+//   :  read ڵ  û ó ʰ    ݾ Ŭ̾Ʈ ٽ  
+int request_complete(const char* request, int len) {
+    const char* head_end = strstr(request, "\r\n\r\n");
+    char value[64];
+    if (!head_end || find_header(request, "Transfer-Encoding", value, sizeof(value))) {
+        return 0;
+    }
+    long body_len = find_header(request, "Content-Length", value, sizeof(value)) ? atol(value) : 0;
+    return head_end + 4 - request + body_len == len;
+}
+
+void writer_init(response_writer* w, int client_socket, int keep_alive, long long total_len) {
+    w->client_socket = client_socket;
+    w->keep_alive = keep_alive;
+    w->header_done = 0;
+    w->head_len = 0;
+    w->total_len = total_len;
+    w->body_left = -1;
+}
+
+void writer_body(response_writer* w, const char* data, int len) {
+    if (len <= 0) return;
+    if (w->client_socket >= 0 && conn_send(w->client_socket, data, len, MSG_NOSIGNAL) != len) {
+        w->keep_alive = 0;
+    }
+    if (w->body_left >= 0) w->body_left -= len;
+}
+
+//    Connection  ٲ ,  ̸      ǥ
+void writer_header(response_writer* w, int header_len) {
+    char length[32];
+    char encoding[32];
+    int status = 0;
+    sscanf(w->head, "HTTP/%*s %d", &status);
+    int has_length = find_header(w->head, "Content-Length", length, sizeof(length));
+    int chunked = find_header(w->head, "Transfer-Encoding", encoding, sizeof(encoding)) && strcasestr(encoding, "chunked");
+    if (has_length) {
+        w->body_left = atoll(length);
+    }
+    else if (status == 204 || status == 304 || status / 100 == 1) {
+        w->body_left = 0;
+    }
+    else if (!chunked && w->total_len < 0) {
+        w->keep_alive = 0;
+    }
+
+    char out[HEAD_SIZE + 96];
+    int len = copy_headers(w->head, header_len, out, HEAD_SIZE);
+    if (len < 0) {
+        //     ״
+        w->keep_alive = 0;
+        writer_body(w, w->head, header_len);
+    }
+    else {
+        // Ŭ̾Ʈ   Ͻ ڽ  (HTTP/1.0  䵵   )
+        if (strncmp(out, "HTTP/1.0", 8) == 0) memcpy(out, "HTTP/1.1", 8);
+        if (!has_length && !chunked && w->total_len >= 0) {
+            w->body_left = w->total_len - header_len;
+            len += sprintf(out + len, "Content-Length: %lld\r\n", w->body_left);
+        }
+        len += sprintf(out + len, "Connection: %s\r\n\r\n", w->keep_alive ? "keep-alive" : "close");
+        if (w->client_socket >= 0 && conn_send(w->client_socket, out, len, MSG_NOSIGNAL) != len) {
+            w->keep_alive = 0;
+        }
+    }
+    w->header_done = 1;
+    writer_body(w, w->head + header_len, w->head_len - header_len);
+}
+
+void writer_send(response_writer* w, const char* data, int len) {
+    if (w->header_done) {
+        writer_body(w, data, len);
+        return;
+    }
+    int n = len < HEAD_SIZE - 1 - w->head_len ? len : HEAD_SIZE - 1 - w->head_len;
+    memcpy(w->head + w->head_len, data, n);
+    w->head_len += n;
+    w->head[w->head_len] = '\0';
+    char* end = strstr(w->head, "\r\n\r\n");
+    if (end) {
+        writer_header(w, end - w->head + 4);
+    }
+    else if (w->head_len == HEAD_SIZE - 1) {
+        //  ʹ  ״   
+        w->keep_alive = 0;
+        w->header_done = 1;
+        writer_body(w, w->head, w->head_len);
+    }
+    else {
+        return;
+    }
+    writer_body(w, data + n, len - n);
+}
+
+//   ġ  ص Ǹ 1 ȯ
+int writer_finish(response_writer* w, int complete) {
+    if (!w->header_done) {
+        w->keep_alive = 0;
+        writer_body(w, w->head, w->head_len);
+    }
+    if (!complete || w->body_left > 0) {
+        w->keep_alive = 0;
+    }
+    return w->keep_alive;
+}
+
+//  ҿ ִ ̹   (Range û )
+int serve_stored(int client_socket, const char* request, const cache_entry* entry, int keep_alive) {
+    char header[512];
+    int header_len;
+    off_t start = 0;
+    off_t end = entry->body_len - 1;
+    int range = parse_range(request, entry->body_len, &start, &end);
+
+    if (range < 0) {
+        header_len = snprintf(header, sizeof(header),
+            "HTTP/1.1 416 Range Not Satisfiable\r\n"
+            "Content-Range: bytes */%lld\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: %s\r\n\r\n",
+            (long long)entry->body_len, keep_alive ? "keep-alive" : "close");
+        return conn_send(client_socket, header, header_len, MSG_NOSIGNAL) == header_len && keep_alive;
+    }
+
+    char content_range[96] = "";
+    if (range > 0) {
+        snprintf(content_range, sizeof(content_range), "Content-Range: bytes %lld-%lld/%lld\r\n",
+            (long long)start, (long long)end, (long long)entry->body_len);
+    }
+    header_len = snprintf(header, sizeof(header),
+        "HTTP/1.1 %s\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %lld\r\n"
+        "ETag: %s\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "%s"
+        "Connection: %s\r\n\r\n",
+        range > 0 ? "206 Partial Content" : "200 OK",
+        entry->content_type, (long long)(end - start + 1), entry->etag, content_range,
+        keep_alive ? "keep-alive" : "close");
+    if (conn_send(client_socket, header, header_len, MSG_NOSIGNAL | MSG_MORE) < 0) {
+        return 0;
+    }
+    return send_file_range(client_socket, entry->store_fd, entry->body_offset + start, end - start + 1) == 0 && keep_alive;
+}
+
+// ĳ ׸  (Ŭ̾Ʈ Ǻ û ġϸ 304),  ص Ǹ 1 ȯ
+int serve_cached(int client_socket, const char* request, const cache_entry* entry, int keep_alive) {
+    if (client_not_modified(request, entry)) {
+        char header[256];
+        int header_len = snprintf(header, sizeof(header),
+            "HTTP/1.1 304 Not Modified\r\n"
+            "ETag: %s\r\n"
+            "Connection: %s\r\n\r\n",
+            entry->etag, keep_alive ? "keep-alive" : "close");
+        return conn_send(client_socket, header, header_len, MSG_NOSIGNAL) == header_len && keep_alive;
+    }
+    if (entry->store_fd >= 0) {
+        return serve_stored(client_socket, request, entry, keep_alive);
+    }
+    response_writer writer;
+    writer_init(&writer, client_socket, keep_alive, entry->response_len);
+    writer_send(&writer, entry->response, entry->response_len);
+    return writer_finish(&writer, 1);
+}
+
+// ū     (̸ ٷ  fdθ )
+int open_spool() {
+    char path[] = IMG_STORE_DIR "/imgXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("spool file create failed");
+        return -1;
+    }
+    unlink(path);
+    return fd;
+}
+
+int write_all(int fd, const char* data, int len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// 200 HTML ̸  պκ PREFETCH_SCAN_BYTES 
+//    ں ȣ  ̾  ( ù  writer head )
+void collect_html(prefetch_info* info, const response_writer* w, const char* data, int len) {
+    if (!info->collect_html || !w->header_done) {
+        return;
+    }
+    if (!info->html) {
+        char content_type[64];
+        int status = 0;
+        sscanf(w->head, "HTTP/%*s %d", &status);
+        const char* head_end = strstr(w->head, "\r\n\r\n");
+        info->collect_html = 0;
+        if (status != 200 || !head_end || w->head_len == HEAD_SIZE - 1
+            || !find_header(w->head, "Content-Type", content_type, sizeof(content_type))
+            || strncasecmp(content_type, "text/html", 9) != 0
+            || !(info->html = malloc(PREFETCH_SCAN_BYTES + 1))) {
+            return;
+        }
+        info->collect_html = 1;
+        info->html_len = w->head + w->head_len - (head_end + 4);
+        memcpy(info->html, head_end + 4, info->html_len);
+        info->html[info->html_len] = '\0';
+        return; // ̹  head ̹  
+    }
+    int n = len < PREFETCH_SCAN_BYTES - info->html_len ? len : PREFETCH_SCAN_BYTES - info->html_len;
+    memcpy(info->html + info->html_len, data, n);
+    info->html_len += n;
+    info->html[info->html_len] = '\0';
+}
+
+//   Ŭ̾Ʈ ϸ鼭 ĳÿ 
+//   ޸𸮿, Ӱ谪 Ѵ ̹  ҿ   
+// client_socket -1̸ ĳÿ  (ġ), info  ġ  ä
+//  ص Ǹ 1 ȯ
+int relay_response(int server_socket, int client_socket, const char* url, int keep_alive, prefetch_info* info) {
+    char buffer[1024];
+    char head[HEAD_SIZE];
+    int head_len = 0;
+    int header_len = -1;
+    off_t total = 0;
+    int spool_fd = -1;
+    int cacheable = url[0] != '\0';
+    unsigned int body_hash = 2166136261u; // ETag  FNV-1a
+    int bytes_received;
+    response_writer writer;
+    writer_init(&writer, client_socket, keep_alive, -1);
+
+    while ((bytes_received = recv(server_socket, buffer, sizeof(buffer), 0)) > 0) {
+        writer_send(&writer, buffer, bytes_received);
+        if (info) {
+            info->received += bytes_received;
+            collect_html(info, &writer, buffer, bytes_received);
+        }
+        if (!cacheable) {
+            continue;
+        }
+
+        //  Ľ̿ պκ 
+        if (head_len < HEAD_SIZE - 1) {
+            int n = bytes_received < HEAD_SIZE - 1 - head_len ? bytes_received : HEAD_SIZE - 1 - head_len;
+            memcpy(head + head_len, buffer, n);
+            head_len += n;
+            head[head_len] = '\0';
+            if (header_len < 0) {
+                char* head_end = strstr(head, "\r\n\r\n");
+                if (head_end) header_len = head_end - head + 4;
+            }
+        }
+
+        // Ӱ谪  ̹ 丸 Ϸ  , ûũ   ûũ  ̹Ƿ  
+        // (total <= SPOOL_THRESHOLD < HEAD_SIZE ̹Ƿ ݱ    head )
+        if (spool_fd < 0 && total + bytes_received > SPOOL_THRESHOLD) {
+            char content_type[64];
+            char encoding[64];
+            if (header_len < 0 || !find_header(head, "Content-Type", content_type, sizeof(content_type))
+                || strncasecmp(content_type, "image/", 6) != 0
+                || find_header(head, "Transfer-Encoding", encoding, sizeof(encoding))
+                || (spool_fd = open_spool()) < 0
+                || write_all(spool_fd, head, total) < 0) {
+                cacheable = 0;
+                continue;
+            }
+        }
+        if (spool_fd >= 0 && write_all(spool_fd, buffer, bytes_received) < 0) {
+            cacheable = 0;
+            continue;
+        }
+
+        for (int i = 0; i < bytes_received; i++) {
+            if (header_len >= 0 && total + i >= header_len) {
+                body_hash = (body_hash ^ (unsigned char)buffer[i]) * 16777619u;
+            }
+        }
+        total += bytes_received;
+    }
+
+    if (bytes_received < 0) {
+        perror("recv from server failed");
+        cacheable = 0; // ߰    
+    }
+    keep_alive = writer_finish(&writer, bytes_received == 0);
+
+    //  Ȯ 丸 : Content-Length    ƾ ϰ,   ᰡ 
+    // Transfer-Encoding   ûũ °  ߷ȴ   Ƿ  
+    int status = 0;
+    char length[32];
+    if (cacheable && header_len >= 0 && !find_header(head, "Transfer-Encoding", length, sizeof(length))) {
+        sscanf(head, "HTTP/%*s %d", &status);
+    }
+    if (status != 200 || (find_header(head, "Content-Length", length, sizeof(length)) && atoll(length) != total - header_len)) {
+        if (spool_fd >= 0) close(spool_fd);
+        return keep_alive;
+    }
+
+    cache_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.url, url, sizeof(entry.url) - 1);
+    entry.timestamp = time(NULL);
+    entry.store_fd = spool_fd;
+    entry.prefetched = client_socket < 0;
+    if (!find_header(head, "Content-Type", entry.content_type, sizeof(entry.content_type))) {
+        strcpy(entry.content_type, "application/octet-stream");
+    }
+    if (!find_header(head, "ETag", entry.etag, sizeof(entry.etag))) {
+        snprintf(entry.etag, sizeof(entry.etag), "\"%x-%llx\"", body_hash, (long long)(total - header_len));
+        entry.etag_generated = 1;
+    }
+    find_header(head, "Last-Modified", entry.last_modified, sizeof(entry.last_modified));
+    entry.body_offset = header_len;
+    entry.body_len = total - header_len;
+    if (spool_fd < 0) {
+        memcpy(entry.response, head, total);
+        entry.response_len = total;
+    }
+    save_cache(&entry);
+    return keep_alive;
+}
+
+long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//  ģ :    accept  epoll ñ ƴϸ 
+void finish_connection(int client_socket, int keep_alive) {
+    if (keep_alive && conn_pending(client_socket) > 0) {
+        // ̹ TLS ۿ  û  epoll ġ ʰ ٷ ť
+        enqueue(client_socket);
+        return;
+    }
+    if (keep_alive && client_socket < MAX_FDS && ++conns[client_socket].requests < MAX_KEEPALIVE_REQUESTS) {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, .data.fd = client_socket };
+        pthread_mutex_lock(&park_lock);
+        conns[client_socket].idle_deadline_ms = now_ms() + KEEPALIVE_TIMEOUT_MS;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) == 0) {
+            pthread_mutex_unlock(&park_lock);
+            return;
+        }
+        conns[client_socket].idle_deadline_ms = 0;
+        pthread_mutex_unlock(&park_lock);
+    }
+    conn_close(client_socket);
+}
+
+int connect_backend(int server_index) {
+    server_info selected_server = web_servers[server_index];
+    struct sockaddr_in server_addr;
+    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket < 0) {
+        perror("Socket creation failed for server");
+        return -1;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(selected_server.port);
+    inet_pton(AF_INET, selected_server.ip, &server_addr.sin_addr);
+
+    if (connect(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Server connect failed");
+        close(server_socket);
+        return -1;
+    }
+    return server_socket;
+}
+
+// ±(tag tag_end )  Ӽ , ã 1 ȯ
+int tag_attr(const char* tag, const char* tag_end, const char* name, char* value, int value_size) {
+    int name_len = strlen(name);
+    for (const char* p = tag + 1; p + name_len < tag_end; p++) {
+        if (!strchr(" \t\r\n", p[-1]) || strncasecmp(p, name, name_len) != 0) {
+            continue;
+        }
+        const char* v = p + name_len;
+        while (v < tag_end && *v == ' ') v++;
+        if (v >= tag_end || *v != '=') {
+            continue;
+        }
+        v++;
+        while (v < tag_end && *v == ' ') v++;
+        char quote = (*v == '"' || *v == '\'') ? *v++ : 0;
+        int len = 0;
+        while (v + len < tag_end && (quote ? v[len] != quote : !strchr(" \t\r\n", v[len]))) len++;
+        if (len == 0 || len >= value_size) {
+            return 0;
+        }
+        memcpy(value, v, len);
+        value[len] = '\0';
+        return 1;
+    }
+    return 0;
+}
+
+//  URL   η ٲ, ٸ ȣƮ data:  0
+int resolve_url(const char* page_url, const char* ref, char* out, int out_size) {
+    int ref_len = strcspn(ref, "#");
+    if (ref_len == 0 || strncmp(ref, "//", 2) == 0 || strcspn(ref, ":") < strcspn(ref, "/?")) {
+        return 0;
+    }
+    int dir_len = 0;
+    if (ref[0] != '/') {
+        int page_len = strcspn(page_url, "?");
+        for (int i = 0; i < page_len; i++) {
+            if (page_url[i] == '/') dir_len = i + 1;
+        }
+    }
+    if (dir_len + ref_len >= out_size) {
+        return 0;
+    }
+    memcpy(out, page_url, dir_len);
+    memcpy(out + dir_len, ref, ref_len);
+    out[dir_len + ref_len] = '\0';
+    return 1;
+}
+
+// ġ ۾ , ť  áų ̹  
+void submit_prefetch(const char* url, const char* host) {
+    pthread_mutex_lock(&prefetch_jobs.mutex);
+    int queued = 0;
+    for (int i = 0, j = prefetch_jobs.front; i < prefetch_jobs.count; i++, j = (j + 1) % PREFETCH_QUEUE_SIZE) {
+        if (strcmp(prefetch_jobs.jobs[j].url, url) == 0) {
+            queued = 1;
+            break;
+        }
+    }
+    if (!queued && prefetch_jobs.count < PREFETCH_QUEUE_SIZE) {
+        prefetch_job* job = &prefetch_jobs.jobs[prefetch_jobs.rear];
+        strcpy(job->url, url);
+        snprintf(job->host, sizeof(job->host), "%s", host);
+        prefetch_jobs.rear = (prefetch_jobs.rear + 1) % PREFETCH_QUEUE_SIZE;
+        prefetch_jobs.count++;
+        pthread_cond_signal(&prefetch_jobs.cond_non_empty);
+    }
+    pthread_mutex_unlock(&prefetch_jobs.mutex);
+}
+
+// HTML <img src> <link href>(stylesheet, icon, preload)  ġ ť 
+void prefetch_links(const char* html, const char* page_url, const char* request) {
+    char host[128] = "";
+    find_header(request, "Host", host, sizeof(host));
+    const char* p = html;
+    while ((p = strchr(p, '<')) != NULL) {
+        p++;
+        const char* attr;
+        if (strncasecmp(p, "img", 3) == 0 && p[3] && strchr(" \t\r\n", p[3])) {
+            attr = "src";
+        }
+        else if (strncasecmp(p, "link", 4) == 0 && p[4] && strchr(" \t\r\n", p[4])) {
+            attr = "href";
+        }
+        else {
+            continue;
+        }
+        const char* tag_end = strchr(p, '>');
+        if (!tag_end) {
+            break;
+        }
+        char ref[256];
+        char rel[64];
+        char url[256];
+        if (attr[0] == 'h' && (!tag_attr(p, tag_end, "rel", rel, sizeof(rel))
+            || !(strcasestr(rel, "stylesheet") || strcasestr(rel, "icon") || strcasestr(rel, "preload")))) {
+            p = tag_end;
+            continue;
+        }
+        if (tag_attr(p, tag_end, attr, ref, sizeof(ref)) && resolve_url(page_url, ref, url, sizeof(url))) {
+            submit_prefetch(url, host);
+        }
+        p = tag_end;
+    }
+}
+
+// ġ : Ŭ̾Ʈ û   ǵ SCHED_IDLE,  Ʈŭ 뿪  
+void* prefetch_worker(void* arg) {
+    struct sched_param param = { 0 };
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) {
+        perror("prefetch SCHED_IDLE failed");
+    }
+    double tokens = PREFETCH_BURST_BYTES;
+    long last_ms = now_ms();
+    while (1) {
+        pthread_mutex_lock(&prefetch_jobs.mutex);
+        while (prefetch_jobs.count == 0) {
+            pthread_cond_wait(&prefetch_jobs.cond_non_empty, &prefetch_jobs.mutex);
+        }
+        prefetch_job job = prefetch_jobs.jobs[prefetch_jobs.front];
+        prefetch_jobs.front = (prefetch_jobs.front + 1) % PREFETCH_QUEUE_SIZE;
+        prefetch_jobs.count--;
+        pthread_mutex_unlock(&prefetch_jobs.mutex);
+
+        //  ٴڳ ä  
+        long now = now_ms();
+        tokens += (now - last_ms) * (PREFETCH_BYTES_PER_SEC / 1000.0);
+        if (tokens > PREFETCH_BURST_BYTES) tokens = PREFETCH_BURST_BYTES;
+        if (tokens < 0) {
+            usleep((useconds_t)(-tokens * 1000000.0 / PREFETCH_BYTES_PER_SEC));
+            tokens = 0;
+            now = now_ms();
+        }
+        last_ms = now;
+
+        // ׻ Ŭ̾Ʈ û ̹ ĳõ  ǳʶ
+        if (cache_has(job.url)) {
+            continue;
+        }
+        int server_socket = connect_backend(load_balance());
+        if (server_socket < 0) {
+            continue;
+        }
+        char request[512];
+        int request_len = job.host[0]
+            ? snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", job.url, job.host)
+            : snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\n\r\n", job.url);
+        send(server_socket, request, request_len, MSG_NOSIGNAL);
+        prefetch_info info = { 0 };
+        relay_response(server_socket, -1, job.url, 0, &info);
+        close(server_socket);
+        tokens -= info.received;
+
+        pthread_mutex_lock(&cache_lock);
+        long stored = prefetch_stored;
+        long used = prefetch_used;
+        pthread_mutex_unlock(&cache_lock);
+        if (stored > 0) {
+            printf("Prefetched %s (%lld bytes), used %ld of %ld (waste %.1f%%)\n",
+                job.url, info.received, used, stored, (stored - used) * 100.0 / stored);
+        }
+    }
+    return NULL;
 }
 
 // Ŭ̾Ʈ û ó
 void* handle_client(void* arg) {
     while (1) {
         int client_socket = dequeue();
+        if (conn_start(client_socket) < 0) {
+            conn_close(client_socket);
+            continue;
+        }
 
         // Ŭ̾Ʈκ URL   ĳÿ Ȯ
         char buffer[1024];
-        int bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
+        int bytes_received = conn_recv(client_socket, buffer, sizeof(buffer) - 1);
         if (bytes_received <= 0) {
-            perror("recv from client failed");
-            close(client_socket);
+            // 0̸   Ŭ̾Ʈ  
+            if (bytes_received < 0) perror("recv from client failed");
+            conn_close(client_socket);
             continue;
         }
 
         buffer[bytes_received] = '\0'; // URL ִ   ó
+        if (bytes_received == sizeof(buffer) - 1 && !strstr(buffer, "\r\n\r\n")) {
+            //  ۺ    ϹǷ  ʰ 
+            static const char too_large[] = "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+                "Content-Length: 0\r\nConnection: close\r\n\r\n";
+            conn_send(client_socket, too_large, sizeof(too_large) - 1, MSG_NOSIGNAL);
+            //   ͸   RST  Ƿ ̹   
+            while (recv(client_socket, buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+            conn_close(client_socket);
+            continue;
+        }
+        int keep_alive = wants_keep_alive(buffer) && request_complete(buffer, bytes_received);
+
+        // û ο URL  (GET ƴϸ ĳ   )
+        char url[256] = "";
+        sscanf(buffer, "GET %255s", url);
 
         // ĳÿ ش URL  ã
-        char* cached_response = find_cache(buffer);
-        if (cached_response) {
+        cache_entry cached;
+        int cache_state = url[0] ? find_cache(url, &cached) : CACHE_MISS;
+        if (cache_state == CACHE_FRESH) {
             // ĳÿ ã  Ŭ̾Ʈ 
-            send(client_socket, cached_response, strlen(cached_response), 0);
-            close(client_socket);
+            keep_alive = serve_cached(client_socket, buffer, &cached, keep_alive);
+            if (cached.store_fd >= 0) close(cached.store_fd);
+            finish_connection(client_socket, keep_alive);
             continue;
         }
+        int stale_fd = cache_state == CACHE_STALE ? cached.store_fd : -1;
 
-        //  κ  
-        int server_index = load_balance();
-        server_info selected_server = web_servers[server_index];
-
-        //   
-        int server_socket;
-        struct sockaddr_in server_addr;
-        server_socket = socket(AF_INET, SOCK_STREAM, 0);
+        //  κ   
+        int server_socket = connect_backend(load_balance());
         if (server_socket < 0) {
-            perror("Socket creation failed for server");
-            close(client_socket);
+            if (stale_fd >= 0) close(stale_fd);
+            conn_close(client_socket);
             continue;
         }
 
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(selected_server.port);
-        inet_pton(AF_INET, selected_server.ip, &server_addr.sin_addr);
-
-        //  
-        if (connect(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-            perror("Server connect failed");
-            close(client_socket);
-            close(server_socket);
-            continue;
+        //  ׸ Ǻ û , 304   ĳÿ 
+        char conditional[2048];
+        int conditional_len = -1;
+        if (cache_state == CACHE_STALE) {
+            conditional_len = build_conditional_request(buffer, &cached, conditional, sizeof(conditional));
         }
-
-        // Ŭ̾Ʈ û  
-        send(server_socket, buffer, bytes_received, 0);
-
-        //   Ŭ̾Ʈ ϰ ĳ 
-        while ((bytes_received = recv(server_socket, buffer, sizeof(buffer), 0)) > 0) {
-            send(client_socket, buffer, bytes_received, 0);
+        //   û  ݵ Connection  
+        const char* request = conditional_len > 0 ? conditional : buffer;
+        int request_len = conditional_len > 0 ? conditional_len : bytes_received;
+        char upstream[2048];
+        int upstream_len = upstream_request(request, request_len, upstream, sizeof(upstream));
+        if (upstream_len < 0) {
+            keep_alive = 0;
         }
-
-        if (bytes_received < 0) {
-            perror("recv from server failed");
+        if (conditional_len > 0) {
+            send(server_socket, upstream_len > 0 ? upstream : request, upstream_len > 0 ? upstream_len : request_len, 0);
+            if (check_not_modified(server_socket, &cached)) {
+                keep_alive = serve_cached(client_socket, buffer, &cached, keep_alive);
+                if (stale_fd >= 0) close(stale_fd);
+                finish_connection(client_socket, keep_alive);
+                close(server_socket);
+                continue;
+            }
+        }
+        else {
+            // Ŭ̾Ʈ û  
+            send(server_socket, upstream_len > 0 ? upstream : request, upstream_len > 0 ? upstream_len : request_len, 0);
         }
+        if (stale_fd >= 0) close(stale_fd);
 
-        //   ĳÿ 
-        save_cache(buffer, buffer);
+        //   Ŭ̾Ʈ ϰ ĳ , HTML̸ ϴ ҽ ġ
+        prefetch_info info = { .collect_html = PREFETCH && url[0] };
+        keep_alive = relay_response(server_socket, client_socket, url, keep_alive, &info);
+        if (info.html) {
+            prefetch_links(info.html, url, buffer);
+            free(info.html);
+        }
 
-        //  ݱ
-        close(client_socket);
+        //  ݱ (Ŭ̾Ʈ     )
+        finish_connection(client_socket, keep_alive);
         close(server_socket);
     }
     return NULL;
@@ -210,6 +1260,12 @@ int main() {
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(LISTENPORT);
 
+    // ū ̹ 
+    if (mkdir(IMG_STORE_DIR, 0700) < 0 && errno != EEXIST) {
+        perror("Store directory create failed");
+        return -1;
+    }
+
     // ε  
     if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         perror("Bind failed");
@@ -223,20 +1279,76 @@ int main() {
         return -1;
     }
 
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        perror("epoll create failed");
+        return -1;
+    }
+
+#ifdef USE_TLS
+    if (tls_init() < 0) {
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN); // SSL_write MSG_NOSIGNAL   
+#endif
+
     // Ŀ  
     pthread_t workers[4];
     for (int i = 0; i < 4; i++) {
         pthread_create(&workers[i], NULL, handle_client, NULL);
     }
+    if (PREFETCH) {
+        pthread_t prefetch_tid;
+        pthread_create(&prefetch_tid, NULL, prefetch_worker, NULL);
+    }
+
+    //  ϰ  û ٸ   Բ 
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = server_socket };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &ev);
+    struct epoll_event events[MAX_EVENTS];
+    long next_sweep_ms = now_ms() + 1000;
 
     // Ŭ̾Ʈ    ť ߰
     while (1) {
-        int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_addr_len);
-        if (client_socket < 0) {
-            perror("Accept failed");
-            continue;
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 1000);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == server_socket) {
+                client_addr_len = sizeof(client_addr);
+                int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_addr_len);
+                if (client_socket < 0) {
+                    perror("Accept failed");
+                    continue;
+                }
+                if (client_socket < MAX_FDS) conns[client_socket].requests = 0;
+                enqueue(client_socket);
+                continue;
+            }
+            //  ῡ  û ԰ų Ŭ̾Ʈ : Ŀ ѱ
+            pthread_mutex_lock(&park_lock);
+            int parked = conns[fd].idle_deadline_ms != 0;
+            if (parked) {
+                conns[fd].idle_deadline_ms = 0;
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            }
+            pthread_mutex_unlock(&park_lock);
+            if (parked) enqueue(fd);
+        }
+
+        //   ִ   
+        long now = now_ms();
+        if (now >= next_sweep_ms) {
+            pthread_mutex_lock(&park_lock);
+            for (int fd = 0; fd < MAX_FDS; fd++) {
+                if (conns[fd].idle_deadline_ms != 0 && conns[fd].idle_deadline_ms <= now) {
+                    conns[fd].idle_deadline_ms = 0;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                    conn_close(fd);
+                }
+            }
+            pthread_mutex_unlock(&park_lock);
+            next_sweep_ms = now + 1000;
         }
-        enqueue(client_socket);
     }
 
     close(server_socket);
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,9 +6,16 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <errno.h>
 #include <time.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <zlib.h> // -lz 로 링크
 
 #define LISTENPORT 5294
 #define PORTNUM3 5298
@@ -16,7 +24,46 @@
 #define MAX_CLIENTS 100
 #define NUM_SERVERS 3
 #define QUEUE_SIZE 10 // Define the size of the queue
+#define REQUEST_SIZE 1024
+#define INLINE_HITS 1 // accept 스레드가 이미 도착한 요청을 읽어 신선한 캐시 히트는 직접 응답, 나머지만 워커로
+#define CACHE_SIZE 100 // 캐시 항목 수
+#define CACHE_MASK_WORDS ((CACHE_SIZE + 63) / 64) // 슬롯 비트맵 크기
 #define CACHE_TIMEOUT 30 // 캐시 만료 시간 (초)
+#define NEG_CACHE_TIMEOUT 5 // 404/410 응답 캐시 시간 (초)
+#define STALE_IF_ERROR 300 // 만료 후 이 시간(초) 안이면 백엔드 오류 때 옛 응답으로 대신함
+#define COMPRESS_THREADS 2 // 압축 전용 스레드 수
+#define COMPRESS_QUEUE_SIZE 32
+#define COMPRESS_MIN_SIZE 256 // 이보다 작은 본문은 압축하지 않음
+
+// 재시도와 헤징
+#define RETRY_BUDGET_RATIO 0.2 // 요청 하나당 쌓이는 재시도 예산 (추가 부하 20%까지)
+#define RETRY_BUDGET_MAX 10.0
+#define LATENCY_SAMPLES 128 // p95 계산에 쓰는 최근 응답 시간 개수
+#define HEDGE_INITIAL_DELAY_MS 100 // 샘플이 모이기 전 헤징 지연
+#define HEDGE_MIN_DELAY_MS 5
+#define CONNECT_TIMEOUT_MS 1000 // 백엔드 연결 한 번
+#define FIRST_BYTE_TIMEOUT_MS 5000 // 첫 연결 시도부터 첫 응답까지 (재시도 연결, 헤징 포함)
+#define IDLE_TIMEOUT_MS 10000 // 첫 응답 뒤 백엔드 recv 한 번
+
+// 관리용 포트 (텍스트 통계)
+#define ADMIN_PORT 5394
+#define TAG_SLOTS 256 // Surrogate-Key 태그 색인 크기 (오픈 어드레싱)
+#define TAG_PROBE 8
+#define PURGE_BATCH 16 // 퍼지가 cache_lock을 한 번 잡고 지우는 최대 항목 수, 사이사이 히트가 들어옴
+
+// find_cache 결과
+#define CACHE_MISS 0
+#define CACHE_FRESH 1
+#define CACHE_STALE 2 // 만료됐지만 검증자가 있어 조건부 요청으로 재검증 가능
+#define CACHE_EXPIRED 3 // 만료됐고 검증자도 없지만 백엔드 오류 때는 사용 가능
+
+// 응답 인코딩
+#define ENCODING_IDENTITY 0
+#define ENCODING_GZIP 1
+#define ENCODING_DEFLATE 2
+
+// 락 통계: -DLOCK_STATS로 빌드하면 LOCK/UNLOCK/COND_WAIT가 등록한 뮤텍스마다 대기/보유 시간 기록
+#include "lock_stats.h"
 
 typedef struct {
     char ip[16];
@@ -25,6 +72,8 @@ typedef struct {
 
 typedef struct {
     int client_socket;
+    int request_len; // accept 스레드가 이미 읽은 요청 길이, 0이면 워커가 recv
+    char request[REQUEST_SIZE];
 } client_request;
 
 typedef struct {
@@ -38,9 +87,36 @@ typedef struct {
 typedef struct {
     char url[256];
     char response[1024];
+    int response_len;
+    int header_len; // response 안에서 본문 시작 위치
+    // 압축 변형 (raw deflate 본문만 저장, gzip/deflate 래퍼와 트레일러는 전송할 때 붙임)
+    char deflated[1024];
+    int deflated_len; // 0이면 압축 변형 없음
+    unsigned long crc; // gzip 트레일러용
+    unsigned long adler; // deflate(zlib) 트레일러용
+    char etag[64];
+    char last_modified[64];
     time_t timestamp;
+    int status; // 200 또는 404/410 (부정 캐시)
+    int max_age; // 초, 상태 코드에 따라 CACHE_TIMEOUT 또는 NEG_CACHE_TIMEOUT
+    char surrogate_keys[128]; // 응답의 Surrogate-Key 헤더 (공백으로 구분한 태그)
+    int tags_unindexed; // 태그 색인에 못 넣은 태그가 있음 (태그 퍼지가 직접 훑음)
 } cache_entry;
 
+// 태그 하나에 속한 캐시 슬롯 비트맵 (태그 퍼지가 캐시를 훑지 않도록)
+typedef struct {
+    char name[64]; // 빈 문자열이면 한 번도 쓰지 않은 슬롯
+    uint64_t slots[CACHE_MASK_WORDS];
+} surrogate_tag;
+
+// 압축 작업 큐 (응답 릴레이 스레드가 압축을 기다리지 않도록 URL만 넘김)
+typedef struct {
+    char urls[COMPRESS_QUEUE_SIZE][256];
+    int front, rear, count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_non_empty;
+} compress_queue;
+
 server_info web_servers[] = {
     {"10.198.138.212", PORTNUM1}, // Example server IP, replace accordingly
     {"10.198.138.212", PORTNUM2},  // Example server IP, replace accordingly
@@ -56,77 +132,857 @@ request_queue queue = {
     .cond_non_full = PTHREAD_COND_INITIALIZER
 };
 
-cache_entry cache[100]; // 캐시 배열, 최대 100개의 항목 저장
+cache_entry cache[CACHE_SIZE]; // 캐시 배열, 퍼지된 슬롯은 free_slots에서 재사용
 int cache_count = 0; // 캐시 항목 개수
+int cache_order[CACHE_SIZE]; // URL 순으로 정렬한 슬롯 번호 (키는 이진 탐색, 접두사는 연속 구간)
+int free_slots[CACHE_SIZE];
+int free_count = 0;
+int slots_used = 0; // 한 번이라도 쓴 슬롯 수
+surrogate_tag tag_index[TAG_SLOTS];
+int unindexed_entries = 0; // tags_unindexed인 캐시 항목 수, 0이면 태그 퍼지가 비트맵만 봄
+long purged_entries = 0; // cache_lock으로 보호
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+long long revalidate_saved_bytes = 0; // 304 재검증으로 서버에서 받지 않은 본문 크기 합 (304도 헤더는 받으므로 제외)
+long negative_hits = 0; // 404/410 캐시로 처리한 요청 수
+long stale_if_error_served = 0; // 백엔드 오류 때 옛 응답으로 대신한 수
+long inline_hits = 0; // accept 스레드에서 바로 응답한 수 (accept 스레드만 갱신)
+
+compress_queue compress_jobs = {
+    .front = 0,
+    .rear = 0,
+    .count = 0,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond_non_empty = PTHREAD_COND_INITIALIZER
+};
 
 int current_server_index = 0;
 pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
+// 첫 응답까지 걸린 시간 샘플과 그 p95 (헤징 지연)
+long latency_samples[LATENCY_SAMPLES];
+int latency_next = 0;
+int latency_count = 0;
+long hedge_delay_ms = HEDGE_INITIAL_DELAY_MS;
+double retry_tokens = RETRY_BUDGET_MAX;
+pthread_mutex_t hedge_lock = PTHREAD_MUTEX_INITIALIZER;
+
+queue_stats queue_usage;
+
 // 라운드 로빈 방식으로 서버 선택
 int load_balance() {
-    pthread_mutex_lock(&lock);
+    LOCK(&lock);
     int server_index = current_server_index;
     current_server_index = (current_server_index + 1) % NUM_SERVERS;
-    pthread_mutex_unlock(&lock);
+    UNLOCK(&lock);
     return server_index;
 }
 
 // 클라이언트 요청을 큐에 추가
-void enqueue(int client_socket) {
-    pthread_mutex_lock(&queue.mutex);
-    while (queue.count == QUEUE_SIZE) {
-        pthread_cond_wait(&queue.cond_non_full, &queue.mutex);
+// request_len이 0보다 크면 accept 스레드가 읽은 요청을 함께 넘김
+void enqueue(int client_socket, const char* request, int request_len) {
+    LOCK(&queue.mutex);
+    if (queue.count == QUEUE_SIZE) {
+        long long start = now_ns();
+        while (queue.count == QUEUE_SIZE) {
+            COND_WAIT(&queue.cond_non_full, &queue.mutex);
+        }
+        queue_usage.full_waits++;
+        queue_usage.full_wait_ns += now_ns() - start;
     }
+    queue_usage_update(&queue_usage, queue.count);
     queue.requests[queue.rear].client_socket = client_socket;
+    queue.requests[queue.rear].request_len = request_len;
+    memcpy(queue.requests[queue.rear].request, request, request_len);
     queue.rear = (queue.rear + 1) % QUEUE_SIZE;
     queue.count++;
     pthread_cond_signal(&queue.cond_non_empty);
-    pthread_mutex_unlock(&queue.mutex);
+    UNLOCK(&queue.mutex);
 }
 
 // 클라이언트 요청을 큐에서 가져오기
-int dequeue() {
-    pthread_mutex_lock(&queue.mutex);
+// 미리 읽은 요청은 req에 복사
+int dequeue(client_request* req) {
+    LOCK(&queue.mutex);
     while (queue.count == 0) {
-        pthread_cond_wait(&queue.cond_non_empty, &queue.mutex);
+        COND_WAIT(&queue.cond_non_empty, &queue.mutex);
     }
-    int client_socket = queue.requests[queue.front].client_socket;
+    queue_usage_update(&queue_usage, queue.count);
+    client_request* front = &queue.requests[queue.front];
+    int client_socket = front->client_socket;
+    req->request_len = front->request_len;
+    memcpy(req->request, front->request, front->request_len);
     queue.front = (queue.front + 1) % QUEUE_SIZE;
     queue.count--;
     pthread_cond_signal(&queue.cond_non_full);
-    pthread_mutex_unlock(&queue.mutex);
+    UNLOCK(&queue.mutex);
     return client_socket;
 }
 
-// 캐시에서 요청 URL에 해당하는 응답 찾기
-char* find_cache(const char* url) {
-    for (int i = 0; i < cache_count; i++) {
-        // 캐시된 응답이 유효한지 확인
-        if (strcmp(cache[i].url, url) == 0 && (time(NULL) - cache[i].timestamp) < CACHE_TIMEOUT) {
-            return cache[i].response;
+// 이하 cache_ 색인 함수는 cache_lock을 잡은 상태에서 호출
+
+// URL이 들어갈 cache_order 위치 (같은 URL이 있으면 그 위치)
+int order_lower_bound(const char* url) {
+    int lo = 0, hi = cache_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(cache[cache_order[mid]].url, url) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// URL의 캐시 슬롯 번호, 없으면 -1
+int cache_lookup(const char* url) {
+    int pos = order_lower_bound(url);
+    return pos < cache_count && strcmp(cache[cache_order[pos]].url, url) == 0 ? cache_order[pos] : -1;
+}
+
+unsigned int tag_hash(const char* name, int len) {
+    unsigned int h = 2166136261u; // FNV-1a
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h;
+}
+
+// 태그 색인 찾기, create면 없을 때 빈 슬롯이나 비트맵이 빈 슬롯을 잡음 (자리가 없으면 NULL)
+surrogate_tag* find_tag(const char* name, int len, int create) {
+    if (len <= 0 || len >= (int)sizeof(tag_index[0].name)) {
+        return NULL;
+    }
+    unsigned int h = tag_hash(name, len);
+    surrogate_tag* reusable = NULL;
+    for (int i = 0; i < TAG_PROBE; i++) {
+        surrogate_tag* tag = &tag_index[(h + i) % TAG_SLOTS];
+        if (strncmp(tag->name, name, len) == 0 && tag->name[len] == '\0') {
+            return tag;
+        }
+        if (tag->name[0] == '\0') {
+            if (!reusable) reusable = tag;
+            break;
+        }
+        if (!reusable) {
+            int empty = 1;
+            for (int w = 0; w < CACHE_MASK_WORDS; w++) empty &= tag->slots[w] == 0;
+            if (empty) reusable = tag;
+        }
+    }
+    if (!create || !reusable) {
+        return NULL;
+    }
+    memcpy(reusable->name, name, len);
+    reusable->name[len] = '\0';
+    return reusable;
+}
+
+// 항목의 Surrogate-Key 태그마다 슬롯 비트를 켜거나 끔
+// 색인이 꽉 찼거나 태그가 너무 길어 못 넣으면 항목에 표시해 두고 태그 퍼지가 따로 훑게 함
+void index_tags(int slot, int set) {
+    const char* p = cache[slot].surrogate_keys;
+    if (!set && cache[slot].tags_unindexed) {
+        unindexed_entries--;
+    }
+    cache[slot].tags_unindexed = 0;
+    while (*p) {
+        p += strspn(p, " ");
+        int len = strcspn(p, " ");
+        surrogate_tag* tag = len > 0 ? find_tag(p, len, set) : NULL;
+        if (tag && set) tag->slots[slot / 64] |= 1ULL << (slot % 64);
+        else if (tag) tag->slots[slot / 64] &= ~(1ULL << (slot % 64));
+        else if (set && len > 0) cache[slot].tags_unindexed = 1;
+        p += len;
+    }
+    if (cache[slot].tags_unindexed) {
+        unindexed_entries++;
+    }
+}
+
+// 공백으로 구분한 태그 목록에 name이 있는지
+int has_tag(const char* keys, const char* name) {
+    int name_len = strlen(name);
+    while (*keys) {
+        keys += strspn(keys, " ");
+        int len = strcspn(keys, " ");
+        if (len == name_len && strncmp(keys, name, len) == 0) {
+            return 1;
+        }
+        keys += len;
+    }
+    return 0;
+}
+
+// cache_order의 pos부터 count개 항목 삭제
+void cache_remove_range(int pos, int count) {
+    for (int i = pos; i < pos + count; i++) {
+        int slot = cache_order[i];
+        index_tags(slot, 0);
+        cache[slot].url[0] = '\0';
+        free_slots[free_count++] = slot;
+    }
+    memmove(cache_order + pos, cache_order + pos + count, sizeof(int) * (cache_count - pos - count));
+    cache_count -= count;
+    purged_entries += count;
+}
+
+// 캐시에서 요청 URL에 해당하는 응답 찾기 (entry에 복사)
+int find_cache(const char* url, cache_entry* entry) {
+    int state = CACHE_MISS;
+    LOCK(&cache_lock);
+    int i = cache_lookup(url);
+    if (i >= 0) {
+        // 캐시된 응답이 유효한지 확인, 만료됐으면 검증자가 있을 때만 재검증 대상
+        time_t age = time(NULL) - cache[i].timestamp;
+        if (age < cache[i].max_age) {
+            state = CACHE_FRESH;
+        }
+        else if (cache[i].etag[0] || cache[i].last_modified[0]) {
+            state = CACHE_STALE;
+        }
+        else if (age < cache[i].max_age + STALE_IF_ERROR) {
+            state = CACHE_EXPIRED;
+        }
+        if (state != CACHE_MISS) {
+            *entry = cache[i];
         }
     }
-    return NULL; // 캐시에서 찾을 수 없으면 NULL 반환
+    UNLOCK(&cache_lock);
+    return state; // 캐시에서 찾을 수 없으면 CACHE_MISS 반환
 }
 
-// 캐시에 응답 저장
-void save_cache(const char* url, const char* response) {
-    if (cache_count < 100) {
-        strncpy(cache[cache_count].url, url, sizeof(cache[cache_count].url));
-        strncpy(cache[cache_count].response, response, sizeof(cache[cache_count].response));
-        cache[cache_count].timestamp = time(NULL);
-        cache_count++;
+// 캐시에 응답 저장 (같은 URL이 있으면 교체)
+void save_cache(const cache_entry* entry) {
+    LOCK(&cache_lock);
+    int pos = order_lower_bound(entry->url);
+    if (pos < cache_count && strcmp(cache[cache_order[pos]].url, entry->url) == 0) {
+        int slot = cache_order[pos];
+        index_tags(slot, 0);
+        cache[slot] = *entry;
+        index_tags(slot, 1);
+    }
+    else {
+        int slot = free_count > 0 ? free_slots[--free_count] : slots_used < CACHE_SIZE ? slots_used++ : -1;
+        if (slot >= 0) {
+            cache[slot] = *entry;
+            memmove(cache_order + pos + 1, cache_order + pos, sizeof(int) * (cache_count - pos));
+            cache_order[pos] = slot;
+            cache_count++;
+            index_tags(slot, 1);
+        }
     }
+    UNLOCK(&cache_lock);
+}
+
+// 백엔드 응답이 없거나 5xx인지 상태 줄만 보고 확인 (응답을 소비하지 않음)
+int upstream_failed(int server_socket) {
+    char head[12];
+    return recv(server_socket, head, sizeof(head), MSG_PEEK | MSG_WAITALL) < (int)sizeof(head) || head[9] == '5';
+}
+
+// 304 재검증 후 캐시 항목의 유효 시간과 검증자 갱신
+void refresh_cache(const cache_entry* entry) {
+    LOCK(&cache_lock);
+    int i = cache_lookup(entry->url);
+    if (i >= 0) {
+        cache[i].timestamp = time(NULL);
+        strcpy(cache[i].etag, entry->etag);
+        strcpy(cache[i].last_modified, entry->last_modified);
+    }
+    UNLOCK(&cache_lock);
+}
+
+// 헤더 값 찾기 (대소문자 무시), 찾으면 잘리기 전 값 길이 + 1 반환 (value_size보다 크면 잘린 것)
+int find_header(const char* head, const char* name, char* value, int value_size) {
+    int name_len = strlen(name);
+    const char* line = strstr(head, "\r\n");
+    while (line && strncmp(line, "\r\n\r\n", 4) != 0) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char* v = line + name_len + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            int len = strcspn(v, "\r\n");
+            int full_len = len;
+            if (len >= value_size) len = value_size - 1;
+            memcpy(value, v, len);
+            value[len] = '\0';
+            return full_len + 1;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return 0;
+}
+
+// HTTP 날짜 해석 (RFC 1123 형식만 지원)
+time_t parse_http_date(const char* date) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (!strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm)) {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+// 클라이언트의 조건부 요청이 캐시 항목과 일치하면 1 반환
+// 304는 200 응답에만 (부정 캐시의 404/410은 조건과 상관없이 그대로 전송)
+int client_not_modified(const char* request, const cache_entry* entry) {
+    char value[128];
+    if (entry->status != 200) {
+        return 0;
+    }
+    if (entry->etag[0] && find_header(request, "If-None-Match", value, sizeof(value))) {
+        return strcmp(value, "*") == 0 || strstr(value, entry->etag) != NULL;
+    }
+    if (entry->last_modified[0] && find_header(request, "If-Modified-Since", value, sizeof(value))) {
+        time_t since = parse_http_date(value);
+        time_t modified = parse_http_date(entry->last_modified);
+        return since != -1 && modified != -1 && modified <= since;
+    }
+    return 0;
+}
+
+// Accept-Encoding에서 coding이 허용되는지 확인 (q=0이면 거부)
+int accepts_encoding(const char* request, const char* coding) {
+    char value[256];
+    if (!find_header(request, "Accept-Encoding", value, sizeof(value))) {
+        return 0;
+    }
+    int coding_len = strlen(coding);
+    char* token = value;
+    while (token) {
+        while (*token == ' ' || *token == ',') token++;
+        char* next = strchr(token, ',');
+        if (strncasecmp(token, coding, coding_len) == 0 && strchr(" ,;", token[coding_len])) {
+            char* q = strstr(token, "q=");
+            return !(q && (!next || q < next) && atof(q + 2) == 0);
+        }
+        token = next;
+    }
+    return 0;
+}
+
+// 압축 변형 전송 (원래 헤더에서 Content-Length를 바꾸고 Content-Encoding 추가)
+void send_compressed(int client_socket, const cache_entry* entry, int encoding) {
+    char header[sizeof(entry->response) + 128];
+    int header_len = 0;
+    const char* line = entry->response;
+    const char* end = entry->response + entry->header_len - 2;
+    while (line < end) {
+        const char* next = strstr(line, "\r\n") + 2;
+        if (entry->etag[0] && strncasecmp(line, "ETag:", 5) == 0) {
+            // 인코딩만 다른 변형이므로 약한 ETag로 (조건부 요청은 그대로 일치)
+            header_len += sprintf(header + header_len, "ETag: %s%s\r\n", strncmp(entry->etag, "W/", 2) ? "W/" : "", entry->etag);
+        }
+        else if (strncasecmp(line, "Content-Length:", 15) != 0 && strncasecmp(line, "Vary:", 5) != 0) {
+            memcpy(header + header_len, line, next - line);
+            header_len += next - line;
+        }
+        line = next;
+    }
+
+    unsigned char wrapper[10];
+    unsigned char trailer[8];
+    int wrapper_len;
+    int trailer_len;
+    unsigned long body_len = entry->response_len - entry->header_len;
+    if (encoding == ENCODING_GZIP) {
+        unsigned char gzip_header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 2, 3 };
+        memcpy(wrapper, gzip_header, sizeof(gzip_header));
+        wrapper_len = 10;
+        for (int i = 0; i < 4; i++) {
+            trailer[i] = (entry->crc >> (8 * i)) & 0xff;
+            trailer[4 + i] = (body_len >> (8 * i)) & 0xff;
+        }
+        trailer_len = 8;
+    }
+    else {
+        wrapper[0] = 0x78;
+        wrapper[1] = 0xda;
+        wrapper_len = 2;
+        for (int i = 0; i < 4; i++) {
+            trailer[i] = (entry->adler >> (8 * (3 - i))) & 0xff;
+        }
+        trailer_len = 4;
+    }
+
+    header_len += snprintf(header + header_len, sizeof(header) - header_len,
+        "Content-Encoding: %s\r\n"
+        "Content-Length: %d\r\n"
+        "Vary: Accept-Encoding\r\n\r\n",
+        encoding == ENCODING_GZIP ? "gzip" : "deflate", wrapper_len + entry->deflated_len + trailer_len);
+
+    struct iovec iov[4] = {
+        { header, header_len },
+        { wrapper, wrapper_len },
+        { (void*)entry->deflated, entry->deflated_len },
+        { trailer, trailer_len }
+    };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 4;
+    sendmsg(client_socket, &msg, MSG_NOSIGNAL);
+}
+
+// 캐시 항목 전송 (클라이언트 조건부 요청이 일치하면 304, 압축을 받으면 압축 변형)
+void serve_cached(int client_socket, const char* request, const cache_entry* entry) {
+    if (client_not_modified(request, entry)) {
+        char header[256];
+        int header_len = snprintf(header, sizeof(header),
+            "HTTP/1.1 304 Not Modified\r\n"
+            "%s%s%s"
+            "Connection: close\r\n\r\n",
+            entry->etag[0] ? "ETag: " : "", entry->etag, entry->etag[0] ? "\r\n" : "");
+        send(client_socket, header, header_len, MSG_NOSIGNAL);
+    }
+    else if (entry->deflated_len > 0 && accepts_encoding(request, "gzip")) {
+        send_compressed(client_socket, entry, ENCODING_GZIP);
+    }
+    else if (entry->deflated_len > 0 && accepts_encoding(request, "deflate")) {
+        send_compressed(client_socket, entry, ENCODING_DEFLATE);
+    }
+    else {
+        send(client_socket, entry->response, entry->response_len, MSG_NOSIGNAL);
+    }
+}
+
+// 신선한 캐시 히트 응답
+void serve_fresh(int client_socket, const char* request, const cache_entry* entry) {
+    if (entry->status != 200) {
+        __atomic_add_fetch(&negative_hits, 1, __ATOMIC_RELAXED);
+    }
+    serve_cached(client_socket, request, entry);
+}
+
+// 압축할 만한 응답인지 확인 (텍스트 계열이고 아직 인코딩되지 않은 것)
+// 캐시 항목(response[1024])에 다 들어간 응답만 대상, 더 크거나 캐시하지 않는 응답은 압축 없이 그대로 릴레이됨
+int is_compressible(const cache_entry* entry) {
+    char value[128];
+    if (entry->response_len - entry->header_len < COMPRESS_MIN_SIZE
+        || find_header(entry->response, "Content-Encoding", value, sizeof(value))
+        || find_header(entry->response, "Transfer-Encoding", value, sizeof(value)) // 본문에 청크 구분이 섞여 있음
+        || !find_header(entry->response, "Content-Type", value, sizeof(value))) {
+        return 0;
+    }
+    return strncasecmp(value, "text/", 5) == 0
+        || strncasecmp(value, "application/json", 16) == 0
+        || strncasecmp(value, "application/javascript", 22) == 0
+        || strncasecmp(value, "application/xml", 15) == 0
+        || strncasecmp(value, "image/svg+xml", 13) == 0;
+}
+
+// 압축 작업 등록, 큐가 가득 차면 버림 (다음 미스 때 다시 시도)
+void submit_compress(const char* url) {
+    LOCK(&compress_jobs.mutex);
+    if (compress_jobs.count < COMPRESS_QUEUE_SIZE) {
+        strcpy(compress_jobs.urls[compress_jobs.rear], url);
+        compress_jobs.rear = (compress_jobs.rear + 1) % COMPRESS_QUEUE_SIZE;
+        compress_jobs.count++;
+        pthread_cond_signal(&compress_jobs.cond_non_empty);
+    }
+    UNLOCK(&compress_jobs.mutex);
+}
+
+// 본문을 raw deflate로 압축, 크기가 줄지 않으면 -1
+int compress_entry(cache_entry* entry) {
+    const unsigned char* body = (const unsigned char*)entry->response + entry->header_len;
+    int body_len = entry->response_len - entry->header_len;
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    zs.next_in = (unsigned char*)body;
+    zs.avail_in = body_len;
+    zs.next_out = (unsigned char*)entry->deflated;
+    zs.avail_out = sizeof(entry->deflated);
+    int ret = deflate(&zs, Z_FINISH);
+    int deflated_len = sizeof(entry->deflated) - zs.avail_out;
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END || deflated_len + 18 >= body_len) {
+        return -1;
+    }
+    entry->deflated_len = deflated_len;
+    entry->crc = crc32(crc32(0L, Z_NULL, 0), body, body_len);
+    entry->adler = adler32(adler32(0L, Z_NULL, 0), body, body_len);
+    return 0;
+}
+
+// 압축 변형을 캐시에 저장 (그 사이 응답이 바뀌었으면 버림)
+void save_compressed(const cache_entry* entry) {
+    LOCK(&cache_lock);
+    int i = cache_lookup(entry->url);
+    if (i >= 0 && cache[i].response_len == entry->response_len
+        && memcmp(cache[i].response, entry->response, entry->response_len) == 0) {
+        memcpy(cache[i].deflated, entry->deflated, entry->deflated_len);
+        cache[i].deflated_len = entry->deflated_len;
+        cache[i].crc = entry->crc;
+        cache[i].adler = entry->adler;
+    }
+    UNLOCK(&cache_lock);
+}
+
+// 압축 스레드: 객체마다 한 번만 압축해서 캐시에 보관
+void* compress_worker(void* arg) {
+    while (1) {
+        char url[256];
+        LOCK(&compress_jobs.mutex);
+        while (compress_jobs.count == 0) {
+            COND_WAIT(&compress_jobs.cond_non_empty, &compress_jobs.mutex);
+        }
+        strcpy(url, compress_jobs.urls[compress_jobs.front]);
+        compress_jobs.front = (compress_jobs.front + 1) % COMPRESS_QUEUE_SIZE;
+        compress_jobs.count--;
+        UNLOCK(&compress_jobs.mutex);
+
+        cache_entry entry;
+        if (find_cache(url, &entry) == CACHE_FRESH && entry.deflated_len == 0 && compress_entry(&entry) == 0) {
+            save_compressed(&entry);
+        }
+    }
+    return NULL;
+}
+
+// 만료된 항목의 검증자를 붙인 조건부 요청 만들기 (클라이언트의 조건부 헤더는 제외)
+int build_conditional_request(const char* request, const cache_entry* entry, char* out, int out_size) {
+    const char* line = strstr(request, "\r\n");
+    if (!line) {
+        return -1;
+    }
+    line += 2;
+    int len = line - request;
+    if (len >= out_size) {
+        return -1;
+    }
+    memcpy(out, request, len);
+    if (entry->etag[0]) {
+        len += snprintf(out + len, out_size - len, "If-None-Match: %s\r\n", entry->etag);
+    }
+    if (entry->last_modified[0] && len < out_size) {
+        len += snprintf(out + len, out_size - len, "If-Modified-Since: %s\r\n", entry->last_modified);
+    }
+    while (*line && len < out_size) {
+        const char* next = strstr(line, "\r\n");
+        int line_len = next ? next + 2 - line : (int)strlen(line);
+        if (strncasecmp(line, "If-None-Match:", 14) != 0 && strncasecmp(line, "If-Modified-Since:", 18) != 0) {
+            if (len + line_len >= out_size) {
+                return -1;
+            }
+            memcpy(out + len, line, line_len);
+            len += line_len;
+        }
+        line += line_len;
+    }
+    return len < out_size ? len : -1;
+}
+
+// 재검증 응답이 304면 캐시 항목을 갱신하고 1 반환 (304가 아니면 응답을 소비하지 않음)
+int check_not_modified(int server_socket, cache_entry* entry) {
+    char head[1024];
+    if (recv(server_socket, head, 12, MSG_PEEK | MSG_WAITALL) < 12 || strncmp(head + 8, " 304", 4) != 0) {
+        return 0;
+    }
+    int n = recv(server_socket, head, sizeof(head) - 1, 0);
+    head[n > 0 ? n : 0] = '\0';
+    find_header(head, "ETag", entry->etag, sizeof(entry->etag));
+    find_header(head, "Last-Modified", entry->last_modified, sizeof(entry->last_modified));
+    refresh_cache(entry);
+
+    long long total = __atomic_add_fetch(&revalidate_saved_bytes, entry->response_len - entry->header_len, __ATOMIC_RELAXED);
+    printf("Revalidated %s (304), upstream bytes saved: %lld\n", entry->url, total);
+    return 1;
+}
+
+// 응답 끝을 확인할 수 있을 때만 1: Content-Length와 본문 길이가 같거나 chunked 종료 청크를 받은 경우
+// 길이 정보 없이 연결 종료로 끝나는 응답은 중간에 끊긴 것과 구분할 수 없어 캐시하지 않음 (부정 캐시 포함)
+int response_complete(const cache_entry* entry) {
+    char value[64];
+    if (find_header(entry->response, "Content-Length", value, sizeof(value))) {
+        return entry->response_len - entry->header_len == atol(value);
+    }
+    if (find_header(entry->response, "Transfer-Encoding", value, sizeof(value)) && strcasestr(value, "chunked")) {
+        return entry->response_len >= entry->header_len + 5
+            && memcmp(entry->response + entry->response_len - 5, "0\r\n\r\n", 5) == 0;
+    }
+    return 0;
+}
+
+// 캐시 유지 시간 (초), 0이면 저장하지 않음 (5xx, 리다이렉트 등)
+int cache_max_age(int status) {
+    if (status == 200) return CACHE_TIMEOUT;
+    if (status == 404 || status == 410) return NEG_CACHE_TIMEOUT;
+    return 0;
+}
+
+// 서버 응답을 클라이언트로 전달하면서 캐시에 저장 (응답 전체가 response에 들어가는 200과 404/410만 저장)
+void relay_response(int server_socket, int client_socket, const char* url) {
+    cache_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    char buffer[1024];
+    int cacheable = url[0] != '\0';
+    int bytes_received;
+
+    while ((bytes_received = recv(server_socket, buffer, sizeof(buffer), 0)) > 0) {
+        send(client_socket, buffer, bytes_received, MSG_NOSIGNAL);
+        if (cacheable && entry.response_len + bytes_received < (int)sizeof(entry.response)) {
+            memcpy(entry.response + entry.response_len, buffer, bytes_received);
+            entry.response_len += bytes_received;
+        }
+        else {
+            cacheable = 0;
+        }
+    }
+
+    if (bytes_received < 0) {
+        perror("recv from server failed");
+        return;
+    }
+
+    int status = 0;
+    sscanf(entry.response, "HTTP/%*s %d", &status);
+    char* head_end = strstr(entry.response, "\r\n\r\n");
+    entry.status = status;
+    entry.max_age = cache_max_age(status);
+    if (!cacheable || entry.max_age == 0 || !head_end) {
+        return;
+    }
+    entry.header_len = head_end - entry.response + 4;
+    if (!response_complete(&entry)) {
+        return;
+    }
+    strncpy(entry.url, url, sizeof(entry.url) - 1);
+    find_header(entry.response, "ETag", entry.etag, sizeof(entry.etag));
+    find_header(entry.response, "Last-Modified", entry.last_modified, sizeof(entry.last_modified));
+    int keys_len = find_header(entry.response, "Surrogate-Key", entry.surrogate_keys, sizeof(entry.surrogate_keys));
+    if (keys_len > (int)sizeof(entry.surrogate_keys)) {
+        // 잘린 마지막 태그는 다른 태그의 접두사와 같아질 수 있으니 버림
+        char* last_space = strrchr(entry.surrogate_keys, ' ');
+        if (last_space) *last_space = '\0';
+        else entry.surrogate_keys[0] = '\0';
+        fprintf(stderr, "Surrogate-Key truncated (%d bytes, keeping \"%s\") for %s\n", keys_len - 1, entry.surrogate_keys, url);
+    }
+    entry.timestamp = time(NULL);
+    save_cache(&entry);
+
+    // 압축은 별도 스레드에서, 이후 히트부터 압축 변형 사용 (릴레이 중인 응답 자체는 압축하지 않음)
+    if (is_compressible(&entry)) {
+        submit_compress(entry.url);
+    }
+}
+
+long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int compare_long(const void* a, const void* b) {
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+// 첫 응답 시간 기록, 16개마다 p95를 다시 계산해 헤징 지연으로 사용
+void record_latency(long latency_ms) {
+    LOCK(&hedge_lock);
+    latency_samples[latency_next] = latency_ms;
+    latency_next = (latency_next + 1) % LATENCY_SAMPLES;
+    if (latency_count < LATENCY_SAMPLES) latency_count++;
+    if (latency_next % 16 == 0) {
+        long sorted[LATENCY_SAMPLES];
+        memcpy(sorted, latency_samples, sizeof(long) * latency_count);
+        qsort(sorted, latency_count, sizeof(long), compare_long);
+        long p95 = sorted[latency_count * 95 / 100];
+        hedge_delay_ms = p95 > HEDGE_MIN_DELAY_MS ? p95 : HEDGE_MIN_DELAY_MS;
+    }
+    UNLOCK(&hedge_lock);
+}
+
+long get_hedge_delay() {
+    LOCK(&hedge_lock);
+    long delay = hedge_delay_ms;
+    UNLOCK(&hedge_lock);
+    return delay;
+}
+
+// 재시도 예산: 요청마다 조금씩 쌓이고 재시도/헤징 한 번에 1씩 씀
+void add_retry_budget() {
+    LOCK(&hedge_lock);
+    retry_tokens += RETRY_BUDGET_RATIO;
+    if (retry_tokens > RETRY_BUDGET_MAX) retry_tokens = RETRY_BUDGET_MAX;
+    UNLOCK(&hedge_lock);
+}
+
+int take_retry_token() {
+    LOCK(&hedge_lock);
+    int ok = retry_tokens >= 1.0;
+    if (ok) retry_tokens -= 1.0;
+    UNLOCK(&hedge_lock);
+    return ok;
+}
+
+// poll 결과에 읽을 응답 바이트가 있는지 (리셋이나 응답 없는 종료도 POLLIN으로 깨우므로 엿봐서 확인)
+int has_response(const struct pollfd* pfd) {
+    char c;
+    return (pfd->revents & POLLIN) && recv(pfd->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
+// 서버와의 연결 설정, CONNECT_TIMEOUT_MS와 deadline_ms 중 빠른 쪽까지만 기다림
+int connect_backend(int server_index, long deadline_ms) {
+    server_info selected_server = web_servers[server_index];
+    struct sockaddr_in server_addr;
+    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket < 0) {
+        perror("Socket creation failed for server");
+        return -1;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(selected_server.port);
+    inet_pton(AF_INET, selected_server.ip, &server_addr.sin_addr);
+
+    // 응답 없는 백엔드가 SYN 재전송 시간(수 분) 동안 워커를 붙잡지 않도록 논블로킹으로 연결
+    int flags = fcntl(server_socket, F_GETFL);
+    fcntl(server_socket, F_SETFL, flags | O_NONBLOCK);
+    if (connect(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        int err = errno;
+        long wait = deadline_ms - now_ms();
+        if (wait > CONNECT_TIMEOUT_MS) wait = CONNECT_TIMEOUT_MS;
+        struct pollfd pfd = { server_socket, POLLOUT, 0 };
+        socklen_t err_len = sizeof(err);
+        if (err != EINPROGRESS || wait <= 0 || poll(&pfd, 1, wait) <= 0 ||
+            getsockopt(server_socket, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0) {
+            fprintf(stderr, "Server connect failed (%s:%d): %s\n", selected_server.ip, selected_server.port,
+                err == EINPROGRESS || err == 0 ? "timed out" : strerror(err));
+            close(server_socket);
+            return -1;
+        }
+    }
+    fcntl(server_socket, F_SETFL, flags);
+    // 응답 중간에 멈춘 백엔드가 워커를 붙잡지 않도록
+    struct timeval idle = { IDLE_TIMEOUT_MS / 1000, IDLE_TIMEOUT_MS % 1000 * 1000 };
+    setsockopt(server_socket, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+    return server_socket;
+}
+
+// 요청을 백엔드로 전달하고 먼저 응답한 서버 소켓 반환
+// 연결이 실패하면 다른 백엔드로 재시도, 멱등 요청은 p95 안에 응답이 없으면 다른 백엔드에도 보냄
+int forward_request(const char* request, int request_len, int idempotent) {
+    add_retry_budget();
+    long start_ms = now_ms();
+    long deadline_ms = start_ms + FIRST_BYTE_TIMEOUT_MS;
+
+    // 라운드 로빈으로 서버 선택, 연결에 실패한 백엔드는 헤징 대상에서도 뺌
+    int first = load_balance();
+    int server_index = first;
+    int failed[NUM_SERVERS] = { 0 };
+    int server_socket = connect_backend(server_index, deadline_ms);
+    for (int i = 1; server_socket < 0 && i < NUM_SERVERS && now_ms() < deadline_ms && take_retry_token(); i++) {
+        failed[server_index] = 1;
+        server_index = (first + i) % NUM_SERVERS;
+        server_socket = connect_backend(server_index, deadline_ms);
+    }
+    if (server_socket < 0) {
+        return -1;
+    }
+    send(server_socket, request, request_len, MSG_NOSIGNAL);
+
+    struct pollfd pfds[2] = {
+        { server_socket, POLLIN, 0 },
+        { -1, POLLIN, 0 }
+    };
+    int hedge_index = -1;
+    for (int i = 1; i < NUM_SERVERS && hedge_index < 0; i++) {
+        if (!failed[(server_index + i) % NUM_SERVERS]) hedge_index = (server_index + i) % NUM_SERVERS;
+    }
+    long hedge_delay = get_hedge_delay();
+    if (hedge_delay > deadline_ms - now_ms()) hedge_delay = deadline_ms - now_ms();
+    if (idempotent && hedge_index >= 0 && hedge_delay > 0 && poll(pfds, 1, hedge_delay) == 0 && take_retry_token()) {
+        // 헤징: 다른 백엔드에 같은 요청을 보내고 먼저 응답한 쪽 사용
+        int hedge_socket = connect_backend(hedge_index, deadline_ms);
+        if (hedge_socket >= 0) {
+            send(hedge_socket, request, request_len, MSG_NOSIGNAL);
+            pfds[1].fd = hedge_socket;
+        }
+    }
+    long remaining = deadline_ms - now_ms();
+    int ready = remaining > 0 ? poll(pfds, pfds[1].fd >= 0 ? 2 : 1, remaining) : 0;
+    // 주 연결이 응답 없이 리셋되거나 닫혔으면 헤징 쪽 응답을 남은 시간 동안 더 기다림
+    if (ready > 0 && pfds[1].fd >= 0 && !has_response(&pfds[0]) && !pfds[1].revents
+        && (remaining = deadline_ms - now_ms()) > 0) {
+        poll(&pfds[1], 1, remaining);
+    }
+    record_latency(now_ms() - start_ms);
+    if (ready <= 0) {
+        // 첫 응답 기한 초과: 호출한 쪽에서 실패로 처리 (stale-if-error 또는 연결 종료)
+        fprintf(stderr, "First byte timeout after %d ms\n", FIRST_BYTE_TIMEOUT_MS);
+        close(server_socket);
+        if (pfds[1].fd >= 0) close(pfds[1].fd);
+        return -1;
+    }
+
+    // 응답이 온 쪽 사용
+    if (pfds[1].fd >= 0) {
+        if (!has_response(&pfds[0]) && has_response(&pfds[1])) {
+            close(server_socket);
+            server_socket = pfds[1].fd;
+        }
+        else {
+            close(pfds[1].fd);
+        }
+    }
+    return server_socket;
+}
+
+// accept 스레드에서 요청이 이미 와 있으면 읽고, 신선한 캐시 히트면 바로 응답 (처리했으면 1)
+// 재검증과 백엔드 요청은 워커로 넘기고, 읽은 요청은 request/request_len으로 돌려줌
+// 응답 전체가 빈 송신 버퍼에 들어갈 때만 여기서 보냄 (blocking send가 바로 끝나고 잘리지 않음), 아니면 워커가 보냄
+int serve_inline(int client_socket, char* request, int* request_len) {
+    *request_len = 0;
+    int n = recv(client_socket, request, REQUEST_SIZE - 1, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    if (n <= 0) {
+        close(client_socket);
+        return 1;
+    }
+    request[n] = '\0';
+    *request_len = n;
+
+    char url[256] = "";
+    sscanf(request, "GET %255s", url);
+    cache_entry cached;
+    if (!url[0] || find_cache(url, &cached) != CACHE_FRESH) {
+        return 0;
+    }
+    // 압축 변형은 헤더가 조금 늘어나므로 여유를 둠, 새 연결이라 송신 버퍼는 비어 있음
+    int sndbuf = 0;
+    socklen_t optlen = sizeof(sndbuf);
+    if (getsockopt(client_socket, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) < 0
+        || sndbuf < cached.response_len + (int)sizeof(cached.etag) + 256) {
+        return 0;
+    }
+    serve_fresh(client_socket, request, &cached);
+    close(client_socket);
+    inline_hits++;
+    return 1;
 }
 
 // 클라이언트 요청 처리
 void* handle_client(void* arg) {
     while (1) {
-        int client_socket = dequeue();
+        client_request req;
+        int client_socket = dequeue(&req);
 
-        // 클라이언트로부터 URL을 받은 후 캐시에서 확인
-        char buffer[1024];
-        int bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
+        // 클라이언트로부터 URL을 받은 후 캐시에서 확인 (accept 스레드가 읽어 뒀으면 그대로 사용)
+        char buffer[REQUEST_SIZE];
+        int bytes_received = req.request_len;
+        if (bytes_received > 0) {
+            memcpy(buffer, req.request, bytes_received);
+        }
+        else {
+            bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
+        }
         if (bytes_received <= 0) {
             perror("recv from client failed");
             close(client_socket);
@@ -135,60 +991,206 @@ void* handle_client(void* arg) {
         
         buffer[bytes_received] = '\0'; // URL이 들어있는 버퍼 종료 처리
 
+        // 요청 라인에서 URL 추출 (GET이 아니면 캐시 사용 안 함)
+        char url[256] = "";
+        sscanf(buffer, "GET %255s", url);
+
         // 캐시에서 해당 URL의 응답을 찾기
-        char* cached_response = find_cache(buffer);
-        if (cached_response) {
+        cache_entry cached;
+        int cache_state = url[0] ? find_cache(url, &cached) : CACHE_MISS;
+        if (cache_state == CACHE_FRESH) {
             // 캐시에서 찾은 응답을 클라이언트로 전송
-            send(client_socket, cached_response, strlen(cached_response), 0);
+            serve_fresh(client_socket, buffer, &cached);
             close(client_socket);
             continue;
         }
 
-        // 라운드 로빈으로 서버 선택
-        int server_index = load_balance();
-        server_info selected_server = web_servers[server_index];
+        // 만료된 항목은 조건부 요청으로 재검증, 304면 본문 없이 캐시에서 전송
+        char conditional[2048];
+        int conditional_len = -1;
+        if (cache_state == CACHE_STALE) {
+            conditional_len = build_conditional_request(buffer, &cached, conditional, sizeof(conditional));
+        }
 
-        // 서버와의 연결 설정
-        int server_socket;
-        struct sockaddr_in server_addr;
-        server_socket = socket(AF_INET, SOCK_STREAM, 0);
+        // 클라이언트 요청을 서버로 전달
+        int idempotent = strncmp(buffer, "GET ", 4) == 0 || strncmp(buffer, "HEAD ", 5) == 0;
+        int server_socket = conditional_len > 0
+            ? forward_request(conditional, conditional_len, idempotent)
+            : forward_request(buffer, bytes_received, idempotent);
+        // 만료 후 STALE_IF_ERROR 안의 항목은 백엔드 오류 때 대신 전송 (stale-if-error)
+        int has_stale = cache_state != CACHE_MISS && time(NULL) - cached.timestamp < cached.max_age + STALE_IF_ERROR;
         if (server_socket < 0) {
-            perror("Socket creation failed for server");
+            if (has_stale) {
+                __atomic_add_fetch(&stale_if_error_served, 1, __ATOMIC_RELAXED);
+                serve_cached(client_socket, buffer, &cached);
+            }
             close(client_socket);
             continue;
         }
-
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(selected_server.port);
-        inet_pton(AF_INET, selected_server.ip, &server_addr.sin_addr);
-
-        // 서버에 연결
-        if (connect(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-            perror("Server connect failed");
+        if (conditional_len > 0 && check_not_modified(server_socket, &cached)) {
+            serve_cached(client_socket, buffer, &cached);
+            close(client_socket);
+            close(server_socket);
+            continue;
+        }
+        if (has_stale && upstream_failed(server_socket)) {
+            __atomic_add_fetch(&stale_if_error_served, 1, __ATOMIC_RELAXED);
+            serve_cached(client_socket, buffer, &cached);
             close(client_socket);
             close(server_socket);
             continue;
         }
-
-        // 클라이언트 요청을 서버로 전달
-        send(server_socket, buffer, bytes_received, 0);
 
         // 서버 응답을 클라이언트로 전달하고 캐시 저장
-        while ((bytes_received = recv(server_socket, buffer, sizeof(buffer), 0)) > 0) {
-            send(client_socket, buffer, bytes_received, 0);
+        relay_response(server_socket, client_socket, url);
+
+        // 소켓 닫기
+        close(client_socket);
+        close(server_socket);
+    }
+    return NULL;
+}
+
+// 통계 출력 (다른 스레드가 갱신 중인 값을 락 없이 읽으므로 근사치)
+void write_stats(int fd) {
+    dprintf(fd, "cache entries %d, revalidate saved bytes %lld\n", cache_count, revalidate_saved_bytes);
+    dprintf(fd, "purged entries %ld, entries outside the tag index %d\n", purged_entries, unindexed_entries);
+    dprintf(fd, "negative cache hits %ld, stale-if-error served %ld\n", negative_hits, stale_if_error_served);
+    dprintf(fd, "inline hits %ld (served on the accept thread)\n", inline_hits);
+    write_lock_stats(fd, &queue_usage, 1);
+}
+
+// 정확한 키 퍼지, 지운 항목 수 반환
+int purge_key(const char* url) {
+    LOCK(&cache_lock);
+    int pos = order_lower_bound(url);
+    int found = pos < cache_count && strcmp(cache[cache_order[pos]].url, url) == 0;
+    if (found) {
+        cache_remove_range(pos, 1);
+    }
+    UNLOCK(&cache_lock);
+    return found;
+}
+
+// 접두사 퍼지: 정렬 색인에서 접두사로 시작하는 연속 구간만 PURGE_BATCH개씩 지움
+int purge_prefix(const char* prefix) {
+    int prefix_len = strlen(prefix);
+    int total = 0;
+    int count;
+    do {
+        LOCK(&cache_lock);
+        int pos = order_lower_bound(prefix);
+        count = 0;
+        while (count < PURGE_BATCH && pos + count < cache_count
+            && strncmp(cache[cache_order[pos + count]].url, prefix, prefix_len) == 0) {
+            count++;
         }
+        cache_remove_range(pos, count);
+        UNLOCK(&cache_lock);
+        total += count;
+    } while (count == PURGE_BATCH);
+    return total;
+}
 
-        if (bytes_received < 0) {
-            perror("recv from server failed");
+// 태그 퍼지: 태그 비트맵에 있는 슬롯만 PURGE_BATCH개씩 지움
+// 색인에 못 넣은 항목이 있으면 이어서 그 항목들의 태그 목록을 정렬 색인 순으로 PURGE_BATCH개씩 훑음
+int purge_tag(const char* name) {
+    int total = 0;
+    int count;
+    do {
+        count = 0;
+        LOCK(&cache_lock);
+        surrogate_tag* tag = find_tag(name, strlen(name), 0);
+        for (int w = 0; tag && w < CACHE_MASK_WORDS && count < PURGE_BATCH; w++) {
+            while (tag->slots[w] && count < PURGE_BATCH) {
+                int slot = w * 64 + __builtin_ctzll(tag->slots[w]);
+                tag->slots[w] &= tag->slots[w] - 1;
+                cache_remove_range(order_lower_bound(cache[slot].url), 1);
+                count++;
+            }
+        }
+        UNLOCK(&cache_lock);
+        total += count;
+    } while (count == PURGE_BATCH);
+    // cache_lock을 놓은 사이 다른 스레드가 항목을 넣고 빼면 위치가 밀리므로
+    // 배치마다 다음에 볼 URL로 위치를 다시 찾음 (그 앞은 모두 확인한 URL)
+    char next_url[256] = "";
+    int more;
+    do {
+        count = 0;
+        LOCK(&cache_lock);
+        int pos = order_lower_bound(next_url);
+        for (; unindexed_entries > 0 && pos < cache_count && count < PURGE_BATCH; pos++) {
+            cache_entry* entry = &cache[cache_order[pos]];
+            if (entry->tags_unindexed && has_tag(entry->surrogate_keys, name)) {
+                cache_remove_range(pos--, 1);
+                count++;
+            }
         }
+        more = count == PURGE_BATCH && pos < cache_count;
+        if (more) {
+            strcpy(next_url, cache[cache_order[pos]].url);
+        }
+        UNLOCK(&cache_lock);
+        total += count;
+    } while (more);
+    return total;
+}
 
-        // 서버 응답을 캐시에 저장
-        save_cache(buffer, buffer);
+// 관리 요청 처리: GET /stats, POST(또는 PURGE) /purge/key/<url>, /purge/prefix/<접두사>, /purge/tag/<태그>
+void handle_admin(int admin_socket) {
+    char request[1024];
+    int len = recv(admin_socket, request, sizeof(request) - 1, 0);
+    if (len <= 0) {
+        return;
+    }
+    request[len] = '\0';
+    char method[16] = "";
+    char path[512] = "";
+    sscanf(request, "%15s %511s", method, path);
+    int purge = strcmp(method, "POST") == 0 || strcmp(method, "PURGE") == 0;
+    if (strcmp(method, "GET") == 0 && (strcmp(path, "/") == 0 || strcmp(path, "/stats") == 0)) {
+        dprintf(admin_socket, "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\n");
+        write_stats(admin_socket);
+    }
+    else if (purge && strncmp(path, "/purge/", 7) == 0) {
+        // 키와 접두사는 '/'로 시작하는 URL 그대로, 태그는 이름만
+        int purged = -1;
+        if (strncmp(path, "/purge/key/", 11) == 0) purged = purge_key(path + 10);
+        else if (strncmp(path, "/purge/prefix/", 14) == 0) purged = purge_prefix(path + 13);
+        else if (strncmp(path, "/purge/tag/", 11) == 0) purged = purge_tag(path + 11);
+        if (purged < 0) {
+            dprintf(admin_socket, "HTTP/1.0 400 Bad Request\r\nContent-Length: 0\r\n\r\n");
+        }
+        else {
+            printf("Purged %d entries (%s)\n", purged, path);
+            dprintf(admin_socket, "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\npurged %d\n", purged);
+        }
+    }
+    else {
+        dprintf(admin_socket, "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+    }
+}
 
-        // 소켓 닫기
-        close(client_socket);
-        close(server_socket);
+void* admin_thread(void* arg) {
+    int admin_socket = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // 관리용은 로컬에서만
+    addr.sin_port = htons(ADMIN_PORT);
+    if (admin_socket < 0 || bind(admin_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(admin_socket, 8) < 0) {
+        perror("Admin socket failed");
+        return NULL;
+    }
+    while (1) {
+        int conn = accept(admin_socket, NULL, NULL);
+        if (conn < 0) {
+            perror("Admin accept failed");
+            continue;
+        }
+        handle_admin(conn);
+        close(conn);
     }
     return NULL;
 }
@@ -223,12 +1225,33 @@ int main() {
         return -1;
     }
 
+    // 요청이 도착한 연결만 accept되도록 해서 인라인 처리 때 recv가 기다리지 않게 함
+    if (INLINE_HITS) {
+        int defer_secs = 1;
+        setsockopt(server_socket, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_secs, sizeof(defer_secs));
+    }
+
+    register_lock(&queue.mutex, "queue.mutex");
+    register_lock(&cache_lock, "cache_lock");
+    register_lock(&lock, "lock (round robin)");
+    register_lock(&hedge_lock, "hedge_lock");
+    register_lock(&compress_jobs.mutex, "compress_jobs.mutex");
+
+    pthread_t admin_tid;
+    pthread_create(&admin_tid, NULL, admin_thread, NULL);
+
     // 워커 스레드 생성
     pthread_t workers[4];
     for (int i = 0; i < 4; i++) {
         pthread_create(&workers[i], NULL, handle_client, NULL);
     }
 
+    // 압축 스레드 생성
+    pthread_t compressors[COMPRESS_THREADS];
+    for (int i = 0; i < COMPRESS_THREADS; i++) {
+        pthread_create(&compressors[i], NULL, compress_worker, NULL);
+    }
+
     // 클라이언트 연결 수락 및 큐에 추가
     while (1) {
         int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_addr_len);
@@ -236,7 +1259,12 @@ int main() {
             perror("Accept failed");
             continue;
         }
-        enqueue(client_socket);
+        char request[REQUEST_SIZE];
+        int request_len = 0;
+        if (INLINE_HITS && serve_inline(client_socket, request, &request_len)) {
+            continue;
+        }
+        enqueue(client_socket, request, request_len);
     }
 
     close(server_socket);
@@ -0,0 +1,218 @@
+// 락 통계 (lb_RR_cache.c, hash.c, RR_cache.c 공용, 각 프로그램이 파일 하나라 정의까지 여기 둠)
+// -DLOCK_STATS로 빌드하면 LOCK/UNLOCK/COND_WAIT가 register_lock으로 등록한 뮤텍스마다
+// 대기/보유 시간 히스토그램과 경합 횟수를 기록, 아니면 pthread 호출 그대로
+// include 전에 QUEUE_SIZE가 정의돼 있어야 함 (큐 길이 분포 크기)
+#ifndef LOCK_STATS_H
+#define LOCK_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define LOCK_TABLE_SIZE 256 // 2의 거듭제곱, 뮤텍스 주소로 찾는 열린 주소 테이블
+#define LOCK_BUCKETS 32 // 2^i ns
+
+// 락 하나의 통계 (락을 잡은 상태에서만 갱신하므로 원자 연산 불필요)
+typedef struct {
+    pthread_mutex_t* mutex; // NULL이면 빈 칸
+    char name[32]; // 같은 이름(샤드마다 있는 락 등)은 출력할 때 합침
+    long acquisitions;
+    long contended; // trylock 실패로 기다린 횟수
+    long long wait_ns;
+    long long hold_ns;
+    long wait_hist[LOCK_BUCKETS];
+    long hold_hist[LOCK_BUCKETS];
+    long long hold_start;
+} lock_stats;
+
+// 요청 큐 사용량 (그 큐의 뮤텍스로 보호)
+typedef struct {
+    long long time_at[QUEUE_SIZE + 1]; // 큐 길이별 누적 시간 (ns), LOCK_STATS 빌드에서만
+    long long last_change_ns;
+    long full_waits; // 큐가 가득 차서 accept 스레드가 기다린 횟수 (lb_RR_cache.c)
+    long long full_wait_ns;
+    long full_rejects; // 큐가 가득 차서 503으로 돌려보낸 횟수 (hash.c, RR_cache.c)
+} queue_stats;
+
+lock_stats lock_table[LOCK_TABLE_SIZE];
+int lock_order[LOCK_TABLE_SIZE]; // 등록 순서 (출력용)
+int lock_count = 0;
+pthread_mutex_t lock_register_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int log2_bucket(long long ns) {
+    if (ns <= 1) return 0;
+    int b = 63 - __builtin_clzll(ns);
+    return b < LOCK_BUCKETS ? b : LOCK_BUCKETS - 1;
+}
+
+unsigned int lock_slot(pthread_mutex_t* mutex) {
+    uintptr_t p = (uintptr_t)mutex;
+    return (unsigned int)((p >> 3) ^ (p >> 13)) & (LOCK_TABLE_SIZE - 1);
+}
+
+// 통계를 낼 뮤텍스 등록 (그 뮤텍스를 쓰는 스레드가 돌기 전에, 여러 스레드에서 불러도 됨)
+void register_lock(pthread_mutex_t* mutex, const char* name) {
+    pthread_mutex_lock(&lock_register_mutex);
+    if (lock_count < LOCK_TABLE_SIZE / 2) {
+        unsigned int i = lock_slot(mutex);
+        while (lock_table[i].mutex && lock_table[i].mutex != mutex) i = (i + 1) & (LOCK_TABLE_SIZE - 1);
+        if (!lock_table[i].mutex) {
+            snprintf(lock_table[i].name, sizeof(lock_table[i].name), "%s", name);
+            lock_order[lock_count++] = i;
+            __atomic_store_n(&lock_table[i].mutex, mutex, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&lock_register_mutex);
+}
+
+lock_stats* find_lock_stats(pthread_mutex_t* mutex) {
+    unsigned int i = lock_slot(mutex);
+    pthread_mutex_t* m;
+    while ((m = __atomic_load_n(&lock_table[i].mutex, __ATOMIC_ACQUIRE)) != NULL) {
+        if (m == mutex) return &lock_table[i];
+        i = (i + 1) & (LOCK_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+void stat_lock(pthread_mutex_t* mutex) {
+    lock_stats* s = find_lock_stats(mutex);
+    long long start = now_ns();
+    int contended = pthread_mutex_trylock(mutex) != 0;
+    if (contended) {
+        pthread_mutex_lock(mutex);
+    }
+    if (!s) return;
+    long long now = now_ns();
+    s->acquisitions++;
+    s->contended += contended;
+    s->wait_ns += now - start;
+    s->wait_hist[log2_bucket(now - start)]++;
+    s->hold_start = now;
+}
+
+void stat_unlock(pthread_mutex_t* mutex) {
+    lock_stats* s = find_lock_stats(mutex);
+    if (s) {
+        long long held = now_ns() - s->hold_start;
+        s->hold_ns += held;
+        s->hold_hist[log2_bucket(held)]++;
+    }
+    pthread_mutex_unlock(mutex);
+}
+
+// 조건 변수 대기 동안은 락을 놓으므로 보유 시간에서 뺌
+void stat_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex) {
+    lock_stats* s = find_lock_stats(mutex);
+    if (s) {
+        long long held = now_ns() - s->hold_start;
+        s->hold_ns += held;
+        s->hold_hist[log2_bucket(held)]++;
+    }
+    pthread_cond_wait(cond, mutex);
+    if (s) {
+        s->acquisitions++;
+        s->hold_start = now_ns();
+    }
+}
+
+#ifdef LOCK_STATS
+#define LOCK(m) stat_lock(m)
+#define UNLOCK(m) stat_unlock(m)
+#define COND_WAIT(c, m) stat_cond_wait(c, m)
+#else
+#define LOCK(m) pthread_mutex_lock(m)
+#define UNLOCK(m) pthread_mutex_unlock(m)
+#define COND_WAIT(c, m) pthread_cond_wait(c, m)
+#endif
+
+// 큐 길이가 바뀌기 직전에 호출 (큐 뮤텍스 보유 상태), count는 바뀌기 전 길이
+void queue_usage_update(queue_stats* q, int count) {
+#ifdef LOCK_STATS
+    long long now = now_ns();
+    if (q->last_change_ns) {
+        q->time_at[count] += now - q->last_change_ns;
+    }
+    q->last_change_ns = now;
+#endif
+}
+
+// 히스토그램에서 q 분위수가 속한 구간의 상한 (ns)
+long long hist_percentile(const long* hist, double q) {
+    long total = 0;
+    for (int i = 0; i < LOCK_BUCKETS; i++) total += hist[i];
+    long seen = 0;
+    for (int i = 0; i < LOCK_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > 0 && seen >= total * q) return 2LL << i;
+    }
+    return 0;
+}
+
+// 락별 통계와 큐 사용량 출력, queues개의 큐(샤드)는 합쳐서 보여 줌
+// 다른 스레드가 갱신 중인 값을 락 없이 읽으므로 근사치
+void write_lock_stats(int fd, const queue_stats* queues, int num_queues) {
+    long full_waits = 0;
+    long long full_wait_ns = 0;
+    long full_rejects = 0;
+    for (int q = 0; q < num_queues; q++) {
+        full_waits += queues[q].full_waits;
+        full_wait_ns += queues[q].full_wait_ns;
+        full_rejects += queues[q].full_rejects;
+    }
+    dprintf(fd, "queue full waits %ld (%.3f ms total), full rejects %ld\n", full_waits, full_wait_ns / 1e6, full_rejects);
+#ifdef LOCK_STATS
+    dprintf(fd, "\n%-22s %10s %10s %10s %10s %10s %10s\n", "lock", "acquired", "contended", "wait ms", "wait p99", "hold ms", "hold p99");
+    for (int i = 0; i < lock_count; i++) {
+        lock_stats sum = lock_table[lock_order[i]];
+        int instances = 1;
+        int duplicate = 0;
+        for (int j = 0; j < lock_count && !duplicate; j++) {
+            lock_stats* l = &lock_table[lock_order[j]];
+            if (j == i || strcmp(l->name, sum.name) != 0) continue;
+            if (j < i) {
+                duplicate = 1;
+                break;
+            }
+            sum.acquisitions += l->acquisitions;
+            sum.contended += l->contended;
+            sum.wait_ns += l->wait_ns;
+            sum.hold_ns += l->hold_ns;
+            for (int b = 0; b < LOCK_BUCKETS; b++) {
+                sum.wait_hist[b] += l->wait_hist[b];
+                sum.hold_hist[b] += l->hold_hist[b];
+            }
+            instances++;
+        }
+        if (duplicate) continue;
+        char name[48];
+        snprintf(name, sizeof(name), instances > 1 ? "%s x%d" : "%s", sum.name, instances);
+        dprintf(fd, "%-22s %10ld %10ld %10.3f %8lldns %10.3f %8lldns\n", name, sum.acquisitions, sum.contended,
+            sum.wait_ns / 1e6, hist_percentile(sum.wait_hist, 0.99), sum.hold_ns / 1e6, hist_percentile(sum.hold_hist, 0.99));
+    }
+    long long time_at[QUEUE_SIZE + 1] = { 0 };
+    long long total = 0;
+    for (int q = 0; q < num_queues; q++) {
+        for (int i = 0; i <= QUEUE_SIZE; i++) {
+            time_at[i] += queues[q].time_at[i];
+            total += queues[q].time_at[i];
+        }
+    }
+    dprintf(fd, "\nqueue length (share of time%s)\n", num_queues > 1 ? ", all shards" : "");
+    for (int i = 0; i <= QUEUE_SIZE && total > 0; i++) {
+        dprintf(fd, "%3d %6.2f%%\n", i, time_at[i] * 100.0 / total);
+    }
+#else
+    dprintf(fd, "lock stats disabled (build with -DLOCK_STATS)\n");
+#endif
+}
+
+#endif
@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// hash.c 라우팅 모드별 백엔드 캐시 효율 재현 (-lm 으로 링크)
+// 사용법: route_replay [트레이스파일|-] [서버수] [백엔드당캐시MB]
+// 트레이스는 한 줄에 "URL [응답바이트] [클라이언트]", 없거나 -면 Zipf 분포 합성 트레이스 사용
+// (hash.c의 hash_trace.bin에는 URL이 없어 그대로 재현할 수 없음)
+// 각 백엔드를 바이트 한도 LRU 캐시로 보고 클라이언트 IP 라우팅, URL 라우팅, URL + 인기 URL 복제를 같은 요청열로 돌려
+// 백엔드 캐시 적중률, 원본에서 받은 바이트, 캐시된 사본 수, 백엔드별 요청 수의 최대/평균을 출력
+// 링, 부하 제한, count-min sketch는 hash.c와 같은 상수와 계산 (AIMD 한도는 무시)
+
+#define MAX_SERVERS 64
+#define VNODES 100
+#define LOAD_FACTOR 1.25
+#define CONCURRENCY 64 // 동시에 처리 중인 요청 수 (부하 제한 계산용), 가장 오래된 요청부터 끝남
+#define SKETCH_DEPTH 4
+#define SKETCH_WIDTH 4096
+#define SKETCH_WINDOW 10000
+#define HOT_THRESHOLD 100
+#define HOT_REPLICAS 2
+
+// 합성 트레이스
+#define SYNTH_URLS 100000
+#define SYNTH_REQUESTS 2000000
+#define SYNTH_CLIENTS 5000
+#define SYNTH_ZIPF 0.9
+#define DEFAULT_SERVERS 8
+#define DEFAULT_CACHE_MB 64
+
+#define ROUTE_IP 0
+#define ROUTE_URL 1
+#define ROUTE_URL_HOT 2
+
+typedef struct {
+    unsigned int hash;
+    int server;
+} ring_point;
+
+// 백엔드 하나의 LRU (URL 번호로 인덱스, -1이면 없음)
+typedef struct {
+    int* prev;
+    int* next;
+    char* cached;
+    int head, tail; // head가 가장 최근
+    long long bytes;
+} backend_cache;
+
+typedef struct {
+    int url;
+    int client;
+} trace_entry;
+
+ring_point ring[MAX_SERVERS * VNODES];
+int num_servers;
+int ring_size;
+int inflight[MAX_SERVERS];
+unsigned int replica_counter = 0;
+unsigned int sketch[SKETCH_DEPTH][SKETCH_WIDTH];
+unsigned int sketch_samples = 0;
+
+char** urls;
+long* url_bytes;
+int url_count = 0;
+int url_capacity = 0;
+char** clients;
+int client_count = 0;
+int client_capacity = 0;
+trace_entry* trace;
+long trace_len = 0;
+long trace_capacity = 0;
+
+unsigned int murmur_hash(char* key) {
+    unsigned int seed = 0x1234abcd;
+    unsigned int m = 0x5bd1e995;
+    unsigned int r = 24;
+    unsigned int len = strlen(key);
+    unsigned int h = seed ^ len;
+    const unsigned char* data = (const unsigned char*)key;
+    while (len >= 4) {
+        unsigned int k = *(unsigned int*)data;
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h *= m;
+        h ^= k;
+        data += 4;
+        len -= 4;
+    }
+    switch (len) {
+    case 3: h ^= data[2] << 16;
+    case 2: h ^= data[1] << 8;
+    case 1: h ^= data[0];
+        h *= m;
+    };
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+    return h;
+}
+
+unsigned int fnv_hash(const char* key) {
+    unsigned int h = 2166136261u;
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int compare_ring_point(const void* a, const void* b) {
+    unsigned int x = ((const ring_point*)a)->hash;
+    unsigned int y = ((const ring_point*)b)->hash;
+    return (x > y) - (x < y);
+}
+
+void build_ring() {
+    ring_size = num_servers * VNODES;
+    for (int i = 0; i < num_servers; i++) {
+        for (int v = 0; v < VNODES; v++) {
+            char name[64];
+            snprintf(name, sizeof(name), "10.0.0.%d:%d#%d", i + 1, 9100, v);
+            ring[i * VNODES + v].hash = murmur_hash(name);
+            ring[i * VNODES + v].server = i;
+        }
+    }
+    qsort(ring, ring_size, sizeof(ring_point), compare_ring_point);
+}
+
+int ring_search(unsigned int hash) {
+    int lo = 0, hi = ring_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo % ring_size;
+}
+
+// hash.c load_balance와 같은 선택 (한도를 넘으면 링 순서상 다음 서버)
+int load_balance(char* key, int replicas) {
+    int pos = ring_search(murmur_hash(key));
+    int order[MAX_SERVERS];
+    int found = 0;
+    unsigned long long seen = 0;
+    for (int i = 0; i < ring_size && found < num_servers; i++) {
+        int server = ring[(pos + i) % ring_size].server;
+        if (!(seen & (1ULL << server))) {
+            seen |= 1ULL << server;
+            order[found++] = server;
+        }
+    }
+    if (replicas > found) replicas = found;
+    int first = replicas > 1 ? replica_counter++ % replicas : 0;
+    int total = 0;
+    for (int i = 0; i < num_servers; i++) {
+        total += inflight[i];
+    }
+    double bound = LOAD_FACTOR * (total + 1) / num_servers;
+    int capacity = (int)bound;
+    if (capacity < bound) capacity++;
+    for (int i = 0; i < found; i++) {
+        int server = i < replicas ? order[(first + i) % replicas] : order[i];
+        if (inflight[server] < capacity) return server;
+    }
+    return order[first];
+}
+
+unsigned int sketch_add(char* key) {
+    unsigned int h1 = murmur_hash(key);
+    unsigned int h2 = fnv_hash(key) | 1;
+    unsigned int estimate = ~0u;
+    for (int i = 0; i < SKETCH_DEPTH; i++) {
+        unsigned int c = ++sketch[i][(h1 + i * h2) % SKETCH_WIDTH];
+        if (c < estimate) estimate = c;
+    }
+    if (++sketch_samples % SKETCH_WINDOW == 0) {
+        for (int i = 0; i < SKETCH_DEPTH; i++) {
+            for (int j = 0; j < SKETCH_WIDTH; j++) {
+                sketch[i][j] >>= 1;
+            }
+        }
+    }
+    return estimate;
+}
+
+// 문자열 → 번호 (열린 주소 해시), 없으면 추가
+int intern(char*** names, int* count, int* capacity, int** table, int* table_size, const char* name) {
+    if (*count * 2 >= *table_size) {
+        int new_size = *table_size ? *table_size * 2 : 1024;
+        int* new_table = malloc(sizeof(int) * new_size);
+        memset(new_table, -1, sizeof(int) * new_size);
+        for (int i = 0; i < *count; i++) {
+            unsigned int h = fnv_hash((*names)[i]) & (new_size - 1);
+            while (new_table[h] >= 0) h = (h + 1) & (new_size - 1);
+            new_table[h] = i;
+        }
+        free(*table);
+        *table = new_table;
+        *table_size = new_size;
+    }
+    unsigned int h = fnv_hash(name) & (*table_size - 1);
+    while ((*table)[h] >= 0) {
+        if (strcmp((*names)[(*table)[h]], name) == 0) return (*table)[h];
+        h = (h + 1) & (*table_size - 1);
+    }
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 1024;
+        *names = realloc(*names, sizeof(char*) * *capacity);
+    }
+    (*names)[*count] = strdup(name);
+    (*table)[h] = *count;
+    return (*count)++;
+}
+
+int* url_table = NULL;
+int url_table_size = 0;
+int* client_table = NULL;
+int client_table_size = 0;
+
+void add_request(const char* url, long bytes, const char* client) {
+    int before = url_count;
+    int id = intern(&urls, &url_count, &url_capacity, &url_table, &url_table_size, url);
+    if (url_count > before) {
+        url_bytes = realloc(url_bytes, sizeof(long) * url_capacity);
+        url_bytes[id] = bytes;
+    }
+    if (trace_len == trace_capacity) {
+        trace_capacity = trace_capacity ? trace_capacity * 2 : 65536;
+        trace = realloc(trace, sizeof(trace_entry) * trace_capacity);
+    }
+    trace[trace_len].url = id;
+    trace[trace_len].client = intern(&clients, &client_count, &client_capacity, &client_table, &client_table_size, client);
+    trace_len++;
+}
+
+int load_trace(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror("trace");
+        return -1;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        char url[512];
+        char client[64] = "";
+        long bytes = 10000;
+        if (sscanf(line, "%511s %ld %63s", url, &bytes, client) < 1) continue;
+        if (!client[0]) snprintf(client, sizeof(client), "10.1.%d.%d", rand() % 20, rand() % 250);
+        add_request(url, bytes, client);
+    }
+    fclose(f);
+    return trace_len > 0 ? 0 : -1;
+}
+
+// Zipf 인기도, 응답 크기는 URL마다 고정된 로그 정규 비슷한 값 (1KB ~ 수백 KB)
+void synth_trace() {
+    double* cdf = malloc(sizeof(double) * SYNTH_URLS);
+    double sum = 0;
+    for (int i = 0; i < SYNTH_URLS; i++) {
+        sum += 1.0 / pow(i + 1, SYNTH_ZIPF);
+        cdf[i] = sum;
+    }
+    srand(1);
+    for (long n = 0; n < SYNTH_REQUESTS; n++) {
+        double x = rand() / (RAND_MAX + 1.0) * sum;
+        int lo = 0, hi = SYNTH_URLS - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] < x) lo = mid + 1;
+            else hi = mid;
+        }
+        char url[64];
+        char client[32];
+        unsigned int h = lo * 2654435761u;
+        snprintf(url, sizeof(url), "/obj/%d.jpg", lo);
+        snprintf(client, sizeof(client), "10.2.%d.%d", rand() % SYNTH_CLIENTS / 250, rand() % 250);
+        add_request(url, 1024 + (long)(exp((h % 1000) / 1000.0 * 5.3) * 1024), client);
+    }
+    free(cdf);
+}
+
+void cache_init(backend_cache* c) {
+    c->prev = malloc(sizeof(int) * url_count);
+    c->next = malloc(sizeof(int) * url_count);
+    c->cached = calloc(url_count, 1);
+    c->head = c->tail = -1;
+    c->bytes = 0;
+}
+
+void cache_unlink(backend_cache* c, int id) {
+    if (c->prev[id] >= 0) c->next[c->prev[id]] = c->next[id];
+    else c->head = c->next[id];
+    if (c->next[id] >= 0) c->prev[c->next[id]] = c->prev[id];
+    else c->tail = c->prev[id];
+}
+
+void cache_push_front(backend_cache* c, int id) {
+    c->prev[id] = -1;
+    c->next[id] = c->head;
+    if (c->head >= 0) c->prev[c->head] = id;
+    c->head = id;
+    if (c->tail < 0) c->tail = id;
+}
+
+// 적중이면 1, 아니면 넣고 0 (한도를 넘는 만큼 오래된 항목 제거)
+int cache_access(backend_cache* c, int id, long long limit) {
+    if (c->cached[id]) {
+        cache_unlink(c, id);
+        cache_push_front(c, id);
+        return 1;
+    }
+    if (url_bytes[id] > limit) return 0;
+    while (c->bytes + url_bytes[id] > limit) {
+        int victim = c->tail;
+        cache_unlink(c, victim);
+        c->cached[victim] = 0;
+        c->bytes -= url_bytes[victim];
+    }
+    cache_push_front(c, id);
+    c->cached[id] = 1;
+    c->bytes += url_bytes[id];
+    return 0;
+}
+
+void replay(const char* name, int mode, long long cache_limit) {
+    backend_cache caches[MAX_SERVERS];
+    for (int i = 0; i < num_servers; i++) {
+        cache_init(&caches[i]);
+    }
+    memset(inflight, 0, sizeof(inflight));
+    memset(sketch, 0, sizeof(sketch));
+    sketch_samples = 0;
+    replica_counter = 0;
+    int window[CONCURRENCY];
+    long hits = 0;
+    long long upstream = 0;
+    long long total = 0;
+    long hot = 0;
+    long served[MAX_SERVERS] = { 0 };
+    for (long n = 0; n < trace_len; n++) {
+        if (n >= CONCURRENCY) {
+            inflight[window[n % CONCURRENCY]]--;
+        }
+        int id = trace[n].url;
+        char* key = mode == ROUTE_IP ? clients[trace[n].client] : urls[id];
+        int replicas = 1;
+        if (mode == ROUTE_URL_HOT && sketch_add(key) >= HOT_THRESHOLD) {
+            replicas = HOT_REPLICAS;
+            hot++;
+        }
+        int server = load_balance(key, replicas);
+        inflight[server]++;
+        window[n % CONCURRENCY] = server;
+        served[server]++;
+        if (cache_access(&caches[server], id, cache_limit)) hits++;
+        else upstream += url_bytes[id];
+        total += url_bytes[id];
+    }
+
+    // 사본 수: 백엔드 캐시에 있는 항목 합 / 서로 다른 URL 수
+    long copies = 0;
+    long distinct = 0;
+    long busiest = 0;
+    for (int i = 0; i < num_servers; i++) {
+        if (served[i] > busiest) busiest = served[i];
+    }
+    for (int id = 0; id < url_count; id++) {
+        int n = 0;
+        for (int i = 0; i < num_servers; i++) n += caches[i].cached[id];
+        copies += n;
+        distinct += n > 0;
+    }
+    printf("%-10s hit %6.2f%%  upstream %8.1f MB (%5.1f%%)  copies/url %.2f  hot %5.1f%%  requests max/avg %.2f\n",
+        name, hits * 100.0 / trace_len, upstream / 1e6, upstream * 100.0 / total,
+        distinct ? (double)copies / distinct : 0, hot * 100.0 / trace_len, busiest * (double)num_servers / trace_len);
+    for (int i = 0; i < num_servers; i++) {
+        free(caches[i].prev);
+        free(caches[i].next);
+        free(caches[i].cached);
+    }
+}
+
+int main(int argc, char** argv) {
+    num_servers = argc > 2 ? atoi(argv[2]) : DEFAULT_SERVERS;
+    long long cache_limit = (argc > 3 ? atoll(argv[3]) : DEFAULT_CACHE_MB) * 1024 * 1024;
+    if (num_servers < 1 || num_servers > MAX_SERVERS || cache_limit <= 0) {
+        fprintf(stderr, "usage: %s [trace|-] [servers 1-%d] [cache MB per backend]\n", argv[0], MAX_SERVERS);
+        return 1;
+    }
+    if (argc > 1 && strcmp(argv[1], "-") != 0) {
+        if (load_trace(argv[1]) < 0) return 1;
+    }
+    else {
+        synth_trace();
+    }
+    long long unique_bytes = 0;
+    for (int i = 0; i < url_count; i++) unique_bytes += url_bytes[i];
+    printf("%ld requests, %d urls (%.1f MB), %d clients, %d servers x %lld MB cache\n",
+        trace_len, url_count, unique_bytes / 1e6, client_count, num_servers, cache_limit / 1024 / 1024);
+    build_ring();
+
+    replay("client ip", ROUTE_IP, cache_limit);
+    replay("url", ROUTE_URL, cache_limit);
+    replay("url + hot", ROUTE_URL_HOT, cache_limit);
+    return 0;
+}
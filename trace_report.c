@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// hash.c가 SIGUSR1에 덤프한 트레이스 파일 분석
+// 사용법: trace_report hash_trace.bin [trace.json]
+// 구간별 지연 히스토그램을 출력하고, json 파일을 주면 Chrome trace / Perfetto 형식으로 저장
+
+#define TRACE_MAGIC 0x43525448
+#define NUM_MARKS 7
+#define NUM_PHASES (NUM_MARKS - 1)
+#define NUM_BUCKETS 32 // 1us부터 2배씩
+
+// hash.c의 trace_record, trace_file_header와 같은 배치
+typedef struct {
+    uint64_t ts[NUM_MARKS];
+    uint32_t worker;
+    uint32_t hit;
+} trace_record;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    double ticks_per_us;
+} trace_file_header;
+
+const char* phase_names[NUM_PHASES] = { "queue", "recv", "cache", "connect", "upstream", "send" };
+
+int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// 구간 i의 시작 시점, 앞 시점을 건너뛴 경우(캐시 히트는 connect/upstream 없음) 그 앞을 씀
+uint64_t phase_start(const trace_record* r, int i) {
+    while (i > 0 && r->ts[i] == 0) i--;
+    return r->ts[i];
+}
+
+void print_histogram(const char* name, double* values, int n) {
+    if (n == 0) {
+        printf("%-9s no samples\n", name);
+        return;
+    }
+    qsort(values, n, sizeof(double), compare_double);
+    printf("%-9s n=%d p50=%.1fus p90=%.1fus p99=%.1fus max=%.1fus\n", name, n,
+        values[n / 2], values[(int)(n * 0.9)], values[(int)(n * 0.99)], values[n - 1]);
+
+    int buckets[NUM_BUCKETS] = { 0 };
+    int max_count = 0;
+    for (int i = 0; i < n; i++) {
+        int b = 0;
+        while (b < NUM_BUCKETS - 1 && values[i] >= (double)(1u << b)) b++;
+        if (++buckets[b] > max_count) max_count = buckets[b];
+    }
+    for (int b = 0; b < NUM_BUCKETS; b++) {
+        if (buckets[b] == 0) continue;
+        int width = buckets[b] * 50 / max_count;
+        printf("  <%8uus %7d ", 1u << b, buckets[b]);
+        for (int i = 0; i < width; i++) putchar('#');
+        putchar('\n');
+    }
+}
+
+void write_chrome_trace(const char* path, trace_record* records, int n, double ticks_per_us) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror("json file");
+        return;
+    }
+    uint64_t base = UINT64_MAX;
+    for (int i = 0; i < n; i++) {
+        if (records[i].ts[0] < base) base = records[i].ts[0];
+    }
+    fprintf(f, "{\"traceEvents\":[\n");
+    int first = 1;
+    for (int i = 0; i < n; i++) {
+        trace_record* r = &records[i];
+        for (int p = 0; p < NUM_PHASES; p++) {
+            if (r->ts[p + 1] == 0) continue;
+            uint64_t start = phase_start(r, p);
+            fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                first ? "" : ",\n", phase_names[p], r->hit ? "hit" : "miss", r->worker,
+                (start - base) / ticks_per_us, (r->ts[p + 1] - start) / ticks_per_us);
+            first = 0;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf("wrote %s\n", path);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s trace.bin [trace.json]\n", argv[0]);
+        return 1;
+    }
+    FILE* f = fopen(argv[1], "rb");
+    if (!f) {
+        perror("trace file");
+        return 1;
+    }
+    trace_file_header header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != TRACE_MAGIC) {
+        fprintf(stderr, "not a trace file\n");
+        fclose(f);
+        return 1;
+    }
+    trace_record* records = malloc(sizeof(trace_record) * (header.count + 1));
+    int n = fread(records, sizeof(trace_record), header.count, f);
+    fclose(f);
+
+    double* values = malloc(sizeof(double) * (n + 1));
+    int hits = 0;
+    for (int i = 0; i < n; i++) {
+        hits += records[i].hit;
+    }
+    printf("%d requests (%d cache hits), %.1f ticks/us\n", n, hits, header.ticks_per_us);
+    for (int p = 0; p < NUM_PHASES; p++) {
+        int count = 0;
+        for (int i = 0; i < n; i++) {
+            if (records[i].ts[p + 1] == 0) continue;
+            values[count++] = (records[i].ts[p + 1] - phase_start(&records[i], p)) / header.ticks_per_us;
+        }
+        print_histogram(phase_names[p], values, count);
+    }
+    int total = 0;
+    for (int i = 0; i < n; i++) {
+        if (records[i].ts[NUM_MARKS - 1] == 0) continue;
+        values[total++] = (records[i].ts[NUM_MARKS - 1] - records[i].ts[0]) / header.ticks_per_us;
+    }
+    print_histogram("total", values, total);
+
+    if (argc > 2) {
+        write_chrome_trace(argv[2], records, n, header.ticks_per_us);
+    }
+    free(values);
+    free(records);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#!/bin/sh
+# hash.c 무중단 업그레이드 테스트 (python3, curl 필요)
+# 사용법: ./upgrade_test.sh [부하시간초]
+# 1. 부하를 거는 동안 새 프로세스를 띄워 리스닝 소켓을 넘기고, 실패한 요청이 없고 이전 프로세스가 끝나는지 확인
+# 2. 업그레이드 디렉터리를 다른 사용자도 쓸 수 있으면 넘겨받지 않고 새로 bind하는지 확인
+# 3. 업그레이드 소켓으로 TCP 리스너가 아닌 fd가 오면 버리고 새로 bind하는지 확인
+# 백엔드 주소는 127.0.0.1, 요청 제한은 끄고, 업그레이드 디렉터리와 공유 메모리 이름은 테스트용으로 바꾼 사본을 빌드함
+# (연달아 새로 bind하므로 사본에만 SO_REUSEADDR를 넣음, 이전 실행의 TIME_WAIT 때문에 bind가 실패하지 않도록)
+
+DURATION=${1:-6}
+CLIENTS=4
+PORT=8080
+DIR=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+UPGRADE_DIR="$WORK/upgrade-$(id -u)"
+PIDS=""
+FAILED=0
+
+cleanup() {
+    for pid in $PIDS; do kill "$pid" 2>/dev/null; done
+    wait 2>/dev/null
+    rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+fail() {
+    echo "FAIL: $1"
+    FAILED=1
+}
+
+sed -e 's/10\.198\.138\.21[23]/127.0.0.1/' \
+    -e 's/#define RATE_LIMIT 1/#define RATE_LIMIT 0/' \
+    -e "s#\"/tmp/hash_lb-%d\"#\"$WORK/upgrade-%d\"#" \
+    -e 's#"/hash_lb_cache-%d"#"/hash_lb_test_cache-%d"#' \
+    -e 's/if (bind(server_socket/setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, \&(int){1}, sizeof(int)); if (bind(server_socket/' \
+    "$DIR/hash.c" > "$WORK/hash.c"
+cc -O2 -I"$DIR" -o "$WORK/hash" "$WORK/hash.c" -lpthread -lrt || exit 1
+
+mkdir "$WORK/www"
+echo "upgrade test" > "$WORK/www/index.html"
+python3 -m http.server 9100 --bind 127.0.0.1 --directory "$WORK/www" > /dev/null 2>&1 &
+PIDS="$PIDS $!"
+
+# 프록시가 PORT에서 응답할 때까지 대기
+wait_ready() {
+    for i in $(seq 50); do
+        curl -s -o /dev/null -m 1 "http://127.0.0.1:$PORT/index.html" && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+load() {
+    end=$(( $(date +%s) + DURATION ))
+    n=0
+    while [ "$(date +%s)" -lt "$end" ]; do
+        curl -s -o /dev/null -m 5 -w '%{http_code}\n' "http://127.0.0.1:$PORT/index.html?c=$1&n=$n"
+        n=$((n + 1))
+    done > "$WORK/load.$1"
+}
+
+echo "== upgrade under load (${DURATION}s, $CLIENTS clients)"
+stdbuf -oL "$WORK/hash" > "$WORK/old.log" 2>&1 &
+OLD=$!
+PIDS="$PIDS $OLD"
+wait_ready || fail "old process did not start"
+LOADERS=""
+for c in $(seq $CLIENTS); do
+    load "$c" &
+    LOADERS="$LOADERS $!"
+done
+sleep $((DURATION / 2))
+stdbuf -oL "$WORK/hash" > "$WORK/new.log" 2>&1 &
+NEW=$!
+PIDS="$PIDS $NEW"
+for pid in $LOADERS; do wait "$pid"; done
+
+total=$(cat "$WORK"/load.* | wc -l)
+bad=$(cat "$WORK"/load.* | grep -vc '^200$')
+echo "requests $total, not 200: $bad"
+[ "$total" -gt 0 ] || fail "no requests completed"
+[ "$bad" -eq 0 ] || fail "$bad requests failed during upgrade"
+grep -q "took over listening socket" "$WORK/new.log" || fail "new process did not take over the socket"
+for i in $(seq 120); do
+    kill -0 "$OLD" 2>/dev/null || break
+    sleep 0.1
+done
+kill -0 "$OLD" 2>/dev/null && fail "old process still running after drain"
+kill "$NEW"
+wait "$NEW" 2>/dev/null
+
+echo "== upgrade dir writable by others"
+chmod 0777 "$UPGRADE_DIR"
+stdbuf -oL "$WORK/hash" > "$WORK/open.log" 2>&1 &
+PIDS="$PIDS $!"
+wait_ready || fail "proxy did not start with an open upgrade dir"
+grep -q "not a private directory" "$WORK/open.log" || fail "open upgrade dir was not rejected"
+kill $!
+wait $! 2>/dev/null
+chmod 0700 "$UPGRADE_DIR"
+
+echo "== non-listener fd on the upgrade socket"
+rm -f "$UPGRADE_DIR/upgrade.sock"
+python3 - "$UPGRADE_DIR/upgrade.sock" <<'EOF' &
+import socket, sys
+l = socket.socket(socket.AF_UNIX); l.bind(sys.argv[1]); l.listen(1)
+c, _ = l.accept()
+u = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+socket.send_fds(c, [b'x'], [u.fileno()])
+c.close()
+EOF
+ROGUE=$!
+sleep 0.3
+stdbuf -oL "$WORK/hash" > "$WORK/rogue.log" 2>&1 &
+PIDS="$PIDS $!"
+wait_ready || fail "proxy did not start after a bad handoff"
+grep -q "not a TCP listener" "$WORK/rogue.log" || fail "non-listener fd was accepted"
+wait $ROGUE 2>/dev/null
+
+if [ "$FAILED" -eq 0 ]; then
+    echo "PASS"
+fi
+exit $FAILED